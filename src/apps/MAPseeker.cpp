@@ -7,6 +7,8 @@
 #define SEQAN_PROFILE // enable time measurements
 
 #include <apps/MAPseeker.h>
+#include <apps/MAPseeker_bgzf.h>
+#include <apps/MAPseeker_count_file.h>
 #include <seqan/seq_io.h>
 #include <seqan/misc/misc_cmdparser.h>
 
@@ -51,12 +53,26 @@ int main(int argc, const char *argv[]) {
 	addOption(parser, addArgumentText(CommandLineOption("O", "outpath", "output path for stats files", OptionType::String, ""), "<out path>"));
 	addOption(parser, addArgumentText(CommandLineOption("N", "start_at_read","align reads starting at this number, going from 0 (e.g., N = job ID)", OptionType::Int, 0), "<int>"));
 	addOption(parser, addArgumentText(CommandLineOption("j", "increment_between_reads", "align reads separated by this increment (e.g., j = total # jobs)", OptionType::Int, 1), "<int>"));
+	addOption(parser, addArgumentText(CommandLineOption("r", "byte_range", "align only the i-th of N equal slices of the fastq files, going from 0 (e.g., i = job ID, N = total # jobs)", OptionType::String, ""), "<i/N>"));
+	addOption(parser, addArgumentText(CommandLineOption("t", "threads", "number of threads to use for aligning read pairs", OptionType::Int, 1), "<int>"));
+	addOption(parser, addArgumentText(CommandLineOption("m", "mmap", "memory-map uncompressed fastq files, and skip copying read ids and qualities", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("C", "count_type", "how to store counts: double, float [half the memory], or fixed [exact 1/n weights]", OptionType::String, "double"), "<type>"));
+	addOption(parser, addArgumentText(CommandLineOption("S", "count_storage", "how to hold counts in memory: auto, dense, or sparse [for big libraries; auto picks by size and density]", OptionType::String, "auto"), "<storage>"));
+	addOption(parser, addArgumentText(CommandLineOption("P", "sparse_output", "output only nonzero counts, as lines of sequence ID, position, count [stats_ID*.sparse.txt]", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("B", "binary_output", "output all counts in one binary file, stats.bin [convert to text with MAPseeker_convert]", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("Z", "compress_output", "compress the binary output file with zlib", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("U", "dedup", "align each distinct read pair once, and count it as many times as it was seen [spills to disk for huge runs]", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("R", "read2_cache", "how many read 2 placements to remember, for read pairs with the same sequence IDs, expt ID, and read 2 [0 to turn off]", OptionType::Int, 65536), "<int>"));
+	addOption(parser, addArgumentText(CommandLineOption("T", "profile", "time each stage of the alignment, and report calls and latencies as JSON [also in profile.json]", OptionType::Bool, false), ""));
 
 	addOption(parser, addArgumentText(CommandLineOption("b", "barcodes", "fasta file containing experimental barcodes", OptionType::String,""), "<FASTA FILE>"));
 	addOption(parser, addArgumentText(CommandLineOption("c", "cseq", "Constant sequence", OptionType::String,""), "<DNA sequence>"));
 	addOption(parser, addArgumentText(CommandLineOption("x", "match_single_nt_variants", "check off-by-one to match sequence ID in read 1", OptionType::Bool, false), ""));
 	addOption(parser, addArgumentText(CommandLineOption("D", "match_DP", "use dynamic programming to match sequence ID in read 2 (allow in/del)", OptionType::Bool, false), ""));
 	addOption(parser, addArgumentText(CommandLineOption("A", "align_all", "try to align short reads, even if ambiguous [useful for MOHCA]", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("L", "read2_length", "align only the first <int> nts of read 2 [faster for long reads, but less sensitive; 0 for the whole read]", OptionType::Int, 0), "<int>"));
+	addOption(parser, addArgumentText(CommandLineOption("W", "read2_window", "search for read 2 only where read 1 says the RT stop can be [from the fragment length it shows], give or take <int> nts [0 to search the whole RNA; nonzero loses a few reads and skips the read 2 cache]", OptionType::Int, 0), "<int>"));
+	addOption(parser, addArgumentText(CommandLineOption("k", "read2_seed", "place read 2 by looking up its first <int> nts in an index of the library, when it matches exactly [up to 32; 0 to always search]", OptionType::Int, 16), "<int>"));
 	addOption(parser, addArgumentText(CommandLineOption("s", "strict", "Enforce read 2 to have zero mismatches (default: up to 2 mismatches)", OptionType::Bool, false), ""));
 	addOption(parser, addArgumentText(CommandLineOption("0", "align_null","go ahead and align null ligations too!", OptionType::Bool, false), ""));
 	addOption(parser, addArgumentText(CommandLineOption("a", "adapter", "Illumina Adapter sequence = 5' DNA sequence shared by all primers", OptionType::String,""), "<DNA sequence>"));
@@ -72,8 +88,9 @@ int main(int argc, const char *argv[]) {
 
 	//This isn't required but shows you how long the processing took
 	SEQAN_PROTIMESTART(loadTime);
-	unsigned seqid_length( 0 ), increment_between_reads( 0 ), start_at_read( 0 );
-	std::string file1,file2,file_library,file_expt_id,file_primers,outfile,outpath;
+	unsigned seqid_length( 0 ), increment_between_reads( 0 ), start_at_read( 0 ), num_threads( 1 );
+	int threads_option( 1 );
+	std::string file1,file2,file_library,file_expt_id,file_primers,outfile,outpath,byte_range;
 	String<char> cseq,adapterSequence,adapterSequence2;
 	getOptionValueLong(parser, "cseq",cseq);
 	getOptionValueLong(parser, "adapter",adapterSequence);
@@ -90,10 +107,78 @@ int main(int argc, const char *argv[]) {
 	bool align_all = isSetLong( parser, "align_all" );
 	bool align_null = isSetLong( parser, "align_null" );
 	bool strict = isSetLong( parser, "strict" );
+	bool use_mmap = isSetLong( parser, "mmap" );
 	if ( align_null && !align_all ) { std::cout << "WARNING: Setting align_all to be true since align_null is true." << std::endl; align_all = true; }
 	getOptionValueLong(parser,"sid_length",seqid_length);
 	getOptionValueLong(parser,"increment_between_reads", increment_between_reads); // for job splitting
 	getOptionValueLong(parser,"start_at_read",start_at_read); // for job splitting
+	getOptionValueLong(parser,"byte_range",byte_range); // for job splitting, without having to read through the whole file.
+	if ( increment_between_reads < 1 ) increment_between_reads = 1;
+	unsigned byte_range_job( 0 ), byte_range_num_jobs( 0 );
+	if ( byte_range.size() > 0 ){
+		if ( sscanf( byte_range.c_str(), "%u/%u", &byte_range_job, &byte_range_num_jobs ) != 2 ||
+				 byte_range_num_jobs < 1 || byte_range_job >= byte_range_num_jobs ) {
+			std::cerr << "ERROR! --byte_range must look like i/N, with 0 <= i < N: " << byte_range << std::endl; exit( 0 );
+		}
+		if ( start_at_read > 0 || increment_between_reads > 1 ) {
+			std::cerr << "ERROR! Cannot use --byte_range together with --start_at_read or --increment_between_reads." << std::endl; exit( 0 );
+		}
+	}
+	getOptionValueLong(parser,"threads",threads_option);
+	int read2_cache_size( 65536 );
+	getOptionValueLong(parser,"read2_cache",read2_cache_size);
+	int read2_length( 0 );
+	getOptionValueLong(parser,"read2_length",read2_length);
+	int read2_seed_length( 16 );
+	getOptionValueLong(parser,"read2_seed",read2_seed_length);
+	int read2_window( 0 );
+	getOptionValueLong(parser,"read2_window",read2_window);
+	std::string count_type_name( "double" );
+	getOptionValueLong(parser,"count_type",count_type_name);
+	CountType count_type;
+	if ( !get_count_type( count_type_name, count_type ) ) {
+		std::cerr << "ERROR! --count_type must be double, float, or fixed: " << count_type_name << std::endl; exit( 0 );
+	}
+	std::string count_storage_name( "auto" );
+	getOptionValueLong(parser,"count_storage",count_storage_name);
+	CountStorage count_storage;
+	if ( !get_count_storage( count_storage_name, count_storage ) ) {
+		std::cerr << "ERROR! --count_storage must be auto, dense, or sparse: " << count_storage_name << std::endl; exit( 0 );
+	}
+	bool sparse_output = isSetLong( parser, "sparse_output" );
+	bool binary_output = isSetLong( parser, "binary_output" );
+	bool compress_output = isSetLong( parser, "compress_output" );
+	bool profile = isSetLong( parser, "profile" );
+	bool dedup = isSetLong( parser, "dedup" );
+	if ( compress_output && !binary_output ) { std::cout << "WARNING: --compress_output only applies to --binary_output; writing binary output." << std::endl; binary_output = true; }
+	if ( threads_option < 1 ) {
+		std::cerr << "ERROR! --threads must be at least 1: " << threads_option << std::endl; exit( 0 );
+	}
+#ifdef _OPENMP
+	if ( threads_option > omp_get_max_threads() ) {
+		std::cout << "WARNING: only " << omp_get_max_threads() << " threads available, so running with " << omp_get_max_threads() << " threads." << std::endl;
+		threads_option = omp_get_max_threads();
+	}
+#else
+	if ( threads_option > 1 ) { std::cout << "WARNING: MAPseeker was compiled without OpenMP, so running with 1 thread." << std::endl; threads_option = 1; }
+#endif
+	num_threads = threads_option;
+	if ( read2_window < 0 ) {
+		std::cerr << "ERROR! --read2_window must be 0 [search the whole RNA] or positive: " << read2_window << std::endl; exit( 0 );
+	}
+	if ( read2_length < 0 ) {
+		std::cerr << "ERROR! --read2_length must be 0 [whole read] or positive: " << read2_length << std::endl; exit( 0 );
+	}
+	if ( read2_length > 0 ) {
+		// with that many edits allowed, a read 2 this short matches almost anywhere, and every read pair gets 'placed'.
+		int const read2_max_errors = match_DP ? 4 : ( strict ? 0 : 2 );
+		if ( read2_length <= read2_max_errors ) {
+			std::cerr << "ERROR! --read2_length " << read2_length << " is too short to place read 2, which is allowed " << read2_max_errors << " errors." << std::endl; exit( 0 );
+		}
+		if ( !match_DP && read2_length < std::min( read2_seed_length, int( max_read2_seed_length ) ) ) {
+			std::cerr << "ERROR! --read2_length " << read2_length << " is shorter than --read2_seed " << read2_seed_length << "; use a longer read 2, or turn off seeds with --read2_seed 0." << std::endl; exit( 0 );
+		}
+	}
 
 	////////////////////////////////////////////////////////////////////
 	// Read in Illumina fastq files
@@ -105,43 +190,54 @@ int main(int argc, const char *argv[]) {
 
 	std::ifstream fastq1(file1.c_str(), std::ios_base::in | std::ios_base::binary);
 	if (!fastq1.good()) { std::cerr << "Problem with file: " << file1 << std::endl; exit( 0 );}
-	RecordReader<std::ifstream, SinglePass<> > reader1(fastq1);
 
 	std::ifstream fastq2(file2.c_str(), std::ios_base::in | std::ios_base::binary);
 	if (!fastq2.good()) { std::cerr << "Problem with file: " << file2 << std::endl; exit( 0 );}
-	RecordReader<std::ifstream, SinglePass<> > reader2(fastq2);
+
+	// fastq files can be gzipped -- no need to gunzip them first.
+	bool const gzipped = is_gz_file( file1 ) || is_gz_file( file2 );
+	bool const bgzipped = is_bgzf_file( file1 ) && is_bgzf_file( file2 );
+#if !SEQAN_HAS_ZLIB
+	if ( gzipped ) { std::cerr << "ERROR! MAPseeker was compiled without zlib, so please gunzip the fastq files first." << std::endl; exit( 0 ); }
+#endif
+	if ( gzipped && use_mmap ) { std::cout << "WARNING: Cannot memory-map gzipped fastq files, so reading them as streams." << std::endl; use_mmap = false; }
+	if ( gzipped && byte_range_num_jobs > 0 ) { std::cerr << "ERROR! Cannot use --byte_range with gzipped fastq files; use -j and --start_at_read instead." << std::endl; exit( 0 ); }
+
+	// which read pairs should this job align?
+	ReadPairSelection selection( start_at_read, increment_between_reads );
+	if ( byte_range_num_jobs > 0 ) seek_to_byte_range( fastq1, fastq2, byte_range_job, byte_range_num_jobs, selection );
 
 
 	//////////////////////////////////////////////
 	// Build up library of RNA sequences
 	//////////////////////////////////////////////
 	// FRAGMENT(read_sequences)
-	String<char> seq1,seq1id,seq2,seq_from_library,seq_from_libraryid,seq_expt_id,qual1,qual2,id1,id2;
+	String<char> seq_from_library;
 	THaystacks haystacks_rna_library, haystacks_expt_ids;
 	std::vector< String<char> > rna_library_vector_RC; //will be used for checking common sequences in the library and seqid_length
-	std::vector< String<char> > short_expt_ids;
+	std::vector< std::string > sequence_names, expt_id_names; // for the binary output file.
+
+	// everything needed by the main loop that does not change from read to read.
+	AlignmentSetup setup;
 
 	// Get all RNA sequences from RNA library, convert to DNA.
 	// Check for sequences with star ('*'), which signifies places where there can
 	//  be extra junk nucleotides.
-	std::vector< CharString > RNA_sequences, sequences_before_star, sequences_after_star;
-	std::vector< unsigned > star_sequence_ids;
-
 	for(unsigned j=0; j< seqCount_library; j++) {
 		assignSeq(seq_from_library, multiSeqFile_library[j], format_library);    // read sequence
-		//      std::string blah;
-		//      assignSeqId(blah, multiSeqFile_library[j], format_library);   // read sequence id
-		//      std::cout << j << " " << blah << " out of " << seqCount_library  << std::endl;
-		check_for_star_sequence( seq_from_library, sequences_before_star, sequences_after_star, star_sequence_ids, j );
+		std::string sequence_name;
+		assignSeqId(sequence_name, multiSeqFile_library[j], format_library);   // read sequence id
+		sequence_names.push_back( sequence_name );
+		check_for_star_sequence( seq_from_library, setup.sequences_before_star, setup.sequences_after_star, setup.star_sequence_ids, j );
 		RNA2DNA( seq_from_library );
-		RNA_sequences.push_back( seq_from_library );
+		setup.RNA_sequences.push_back( seq_from_library );
 	}
 
 	// Index library sequences for alignment
 	unsigned max_rna_len( 0 );
 	std::cout << "Indexing Sequences(N=" << seqCount_library << ")..";
 	for(unsigned j=0; j< seqCount_library; j++) {
-		CharString seq_from_library = RNA_sequences[ j ];
+		CharString seq_from_library = setup.RNA_sequences[ j ];
 		appendValue(haystacks_rna_library, seq_from_library);
 		if ( max_rna_len < length( seq_from_library ) ) max_rna_len = length( seq_from_library );
 
@@ -149,7 +245,9 @@ int main(int argc, const char *argv[]) {
 		reverseComplement( seq_from_library_RC );
 		rna_library_vector_RC.push_back( seq_from_library_RC );
 	}
-	Finder<Index<THaystacks> > finder_sequence_id( haystacks_rna_library );
+	// build the suffix array now, so that every thread can search it without modifying it.
+	Index<THaystacks> index_sequence_id( haystacks_rna_library );
+	indexRequire( index_sequence_id, EsaSA() );
 	std::cout << "completed" << std::endl;
 	std::cout << "RNA sequence Lengths(max=" << max_rna_len <<"):" << std::endl;
 
@@ -157,8 +255,8 @@ int main(int argc, const char *argv[]) {
 	////////////////////////////////////////////////////////////////////////////////
 	// Figure out experimental IDs and primer binding site from primer sequences.
 	///////////////////////////////////////////////////////////////////////////////
-	figure_out_expt_IDs( file_primers, file_expt_id, short_expt_ids, haystacks_expt_ids, cseq, adapterSequence );
-	unsigned seqCount_expt_id = short_expt_ids.size();
+	figure_out_expt_IDs( file_primers, file_expt_id, setup.short_expt_ids, expt_id_names, haystacks_expt_ids, cseq, adapterSequence );
+	unsigned seqCount_expt_id = setup.short_expt_ids.size();
 
 	CharString adapterSequenceRC =  adapterSequence;
 	reverseComplement( adapterSequenceRC );
@@ -166,267 +264,797 @@ int main(int argc, const char *argv[]) {
 	if ( length( adapterSequence2 ) == 0 ) adapterSequence2 = universal_adapter_sequence2;
 
 	check_unique_id( rna_library_vector_RC, cseq, seqid_length, max_rna_len );
-
-	//    Index<THaystacks> index_expt_ids(haystacks_expt_ids);
-	Finder<Index<THaystacks> > finder_expt_id(haystacks_expt_ids);
+	setup_sequence_id_table( setup.sequence_id_table, setup.RNA_sequences, cseq, seqid_length, index_sequence_id, match_single_nt_variants );
+
+	Index<THaystacks> index_expt_id( haystacks_expt_ids );
+	indexRequire( index_expt_id, EsaSA() );
+	setup_expt_id_classifier( setup.expt_id_classifier, setup.short_expt_ids, index_expt_id );
+
+	setup.cseq = cseq;
+	setup.adapterSequenceRC = adapterSequenceRC;
+	setup.adapterSequence2 = adapterSequence2;
+	setup.seqid_length = seqid_length;
+	setup.max_rna_len = max_rna_len;
+	setup.read2_length = read2_length;
+	setup.read2_window = read2_window;
+	setup.match_single_nt_variants = match_single_nt_variants;
+	setup.match_DP = match_DP;
+	setup.align_all = align_all;
+	setup.align_null = align_null;
+	setup.strict = strict;
+	setup.profile = profile;
+	setup.dedup = dedup;
+	setup_read2_cache( setup.read2_cache, read2_cache_size > 0 ? read2_cache_size : 0 );
+	setup.count_type = count_type;
+	setup.count_storage = count_storage;
+	setup_reference_arena( setup.reference_arena, setup );
+	// the seed index stands in for the Myers search, so it needs the references in the arena; not for DP.
+	if ( setup.reference_arena.enabled && !match_DP && read2_seed_length > 0 ) {
+		setup_read2_seed_index( setup.read2_seed_index, setup.RNA_sequences, setup.reference_arena.references,
+														setup.reference_arena.mpos_max, setup.reference_arena.num_expt_ids, read2_seed_length );
+	}
+	setup.myers_kernel = get_multi_text_myers_kernel();
 
 	std::cout << "Setup of MiSEQ, RNA library, primer sequence files took: " << SEQAN_PROTIMEDIFF(loadTime) << " seconds." << std::endl;
 
-	// initialize a histogram recording the counts [convenient for plotting in matlab, R, etc.]
-	std::vector< double > sequence_counts( max_rna_len+1, 0.0 );
-	std::vector< std::vector< double > > bunch_of_sequence_counts( seqCount_library, sequence_counts);
-	std::vector< std::vector< std::vector < double > > > all_count( seqCount_expt_id, bunch_of_sequence_counts);
-	//    std::vector< std::vector< std::vector < double > > > all_count_strict = all_count;
+	// each thread keeps its own histogram of counts and its own purification table; these get summed up at the end.
+	std::vector< AlignmentWorker * > workers( num_threads, (AlignmentWorker *) 0 );
 
-	// keep track of how many sequences pass through each filter
-	std::vector< unsigned > counter_counts;
-	std::vector< std::string > counter_tags;
-	unsigned perfect( 0 ), nullLigation( 0 );
-
-
-	std::cout << "Running alignment" << std::endl;
+	std::cout << "Running alignment";
+	if ( num_threads > 1 ) std::cout << " with " << num_threads << " threads";
+	std::cout << std::endl;
 	SEQAN_PROTIMESTART(alignTime); // reset counter.
 
-	////////////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////////////
-	//                       MAIN LOOP!                           //
-	////////////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////////////
-	while (!atEnd(reader1) && !atEnd(reader2)){
-
-		if (readRecord(id1, seq1, qual1, reader1, seqan::Fastq()) != 0) return 1;
-		if (readRecord(id2, seq2, qual2, reader2, seqan::Fastq()) != 0) return 1;
-
-		reverseComplement(seq1);
-
-		unsigned counter_idx( 0 ); // will keep track of which filter we pass.
-		record_counter( "total", counter_idx, counter_counts, counter_tags );
-
-		int pos1( -1 ), constant_sequence_begin_pos( -1 ), expt_idx( -1 );
-
-		///////////////////////////////////////////////////////////////////////////////////////////
-		// Look for the constant region (primer binding site) -- JP's trick.
-		// In future could do multi-pattern search for multiple primers ... in that
-		// case, we'll have to rewrite this code unfortunately.
-		///////////////////////////////////////////////////////////////////////////////////////////
-		//pos1 = try_exact_match( seq1, cseq, perfect );  //  interesting -- DPsearch (see next) is no slower than available exact matches.
-		if ( pos1 < 0 ) pos1 = try_DP_match( seq1, cseq, perfect ); // allows for 1 mismatch, 2 deletions
-		if ( pos1 < 0 ) continue;
-		record_counter( "found primer binding site", counter_idx, counter_counts, counter_tags );
-
-		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Look for experimental ID (expt ID that follows constant primer binding site, and is coded by reverse transcription primer)
-		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		// first look for exact match -- should be super-fast, as using index.
-		String<char> expt_id_in_read1 = suffix(seq1,(pos1+1));
-		if ( find( finder_expt_id, expt_id_in_read1 ) )	{
-			expt_idx = beginPosition(finder_expt_id).i1;
+	if ( bgzipped ) {
+#if SEQAN_HAS_ZLIB
+		// bgzip'ed files can be inflated on several threads, block by block.
+		std::cout << "Decompressing BGZF fastq files";
+		if ( num_threads > 1 ) std::cout << " with " << num_threads << " threads";
+		std::cout << std::endl;
+		ParallelBgzfReader bgzf1, bgzf2;
+		if ( !open( bgzf1, file1, num_threads ) ) { std::cerr << "Problem with file: " << file1 << std::endl; exit( 0 );}
+		if ( !open( bgzf2, file2, num_threads ) ) { std::cerr << "Problem with file: " << file2 << std::endl; exit( 0 );}
+		RecordReader< ParallelBgzfReader, SinglePass<> > reader1( bgzf1 ), reader2( bgzf2 );
+		align_fastq_files( reader1, reader2, selection, setup, index_sequence_id, index_expt_id, seqCount_expt_id, seqCount_library, workers );
+#endif
+	} else if ( gzipped ) {
+#if SEQAN_HAS_ZLIB
+		// Stream<GZFile> also reads uncompressed files, in case only one of the two is gzipped.
+		Stream<GZFile> gz1, gz2;
+		if ( !open( gz1, file1.c_str(), "r" ) ) { std::cerr << "Problem with file: " << file1 << std::endl; exit( 0 );}
+		if ( !open( gz2, file2.c_str(), "r" ) ) { std::cerr << "Problem with file: " << file2 << std::endl; exit( 0 );}
+		RecordReader< Stream<GZFile>, SinglePass<> > reader1( gz1 ), reader2( gz2 );
+		align_fastq_files( reader1, reader2, selection, setup, index_sequence_id, index_expt_id, seqCount_expt_id, seqCount_library, workers );
+#endif
+	} else if ( use_mmap ) {
+		TFastqMMap mmap1, mmap2;
+		if ( !open( mmap1, file1.c_str(), OPEN_RDONLY ) ) { std::cerr << "Problem with file: " << file1 << std::endl; exit( 0 );}
+		if ( !open( mmap2, file2.c_str(), OPEN_RDONLY ) ) { std::cerr << "Problem with file: " << file2 << std::endl; exit( 0 );}
+		mmapAdvise( mmap1, MAP_SEQUENTIAL );
+		mmapAdvise( mmap2, MAP_SEQUENTIAL );
+		TFastqMMapReader reader1( mmap1 ), reader2( mmap2 );
+		if ( byte_range_num_jobs > 0 && !selection.done ) { // start where seek_to_byte_range() left the streams.
+			setPosition( reader1, std::streamoff( fastq1.tellg() ) );
+			setPosition( reader2, std::streamoff( fastq2.tellg() ) );
 		}
-		clear( finder_expt_id );
+		align_fastq_files( reader1, reader2, selection, setup, index_sequence_id, index_expt_id, seqCount_expt_id, seqCount_library, workers );
+	} else {
+		RecordReader< std::ifstream, SinglePass<> > reader1( fastq1 ), reader2( fastq2 );
+		align_fastq_files( reader1, reader2, selection, setup, index_sequence_id, index_expt_id, seqCount_expt_id, seqCount_library, workers );
+	}
+	if ( selection.read_error ) { std::cerr << "ERROR! Problem reading fastq files." << std::endl; return 1; }
+
+	// sum up counts over threads.
+	CountTensor all_count;
+	PurificationTable purification;
+	resize_purification_table( purification, seqCount_expt_id );
+	ProfileStageTimes profile_times;
+	for ( unsigned t = 0; t < workers.size(); t++ ){
+		if ( workers[ t ] == 0 ) continue;
+		merge_counts( *workers[ t ], all_count, purification, profile_times );
+		delete workers[ t ];
+	}
 
-		if ( expt_idx < 0) expt_idx = try_DP_match_expt_ids( short_expt_ids, expt_id_in_read1 );
+	double const align_time = SEQAN_PROTIMEDIFF(alignTime);
+	std::cout << "Aligning " << get_counter_total( purification, TOTAL_COUNTER ) << " sequences took " << align_time << " seconds " << std::endl;
 
-		// this avoids findBegin, but assumes no indels in constant primer binding sequence
-		if ( constant_sequence_begin_pos < 0 ) constant_sequence_begin_pos = pos1 - length( cseq);
+	output_purification_table( purification, expt_id_names, align_all, setup.read2_seed_index.enabled );
 
-		if( expt_idx < 0 ) continue;
-		record_counter( "found expt ID site", counter_idx, counter_counts, counter_tags );
+	if ( setup.read2_cache.enabled ) {
+		std::cout << std::endl;
+		std::cout << "Read 2 cache hits        : " << get_read2_cache_hits( setup.read2_cache ) << std::endl;
+		std::cout << "Read 2 cache misses      : " << get_read2_cache_misses( setup.read2_cache ) << std::endl;
+	}
 
-		////////////////////////////////////////////////////////////////////////////////////////
-		// Look for the sequence ID (i.e., the identifier sequence at the 3' end of the RNA)
-		// in a region of seqid nucleotides before the constant (primer-binding) site.
-		// seqid is the (minimum) length of the barcode...
-		////////////////////////////////////////////////////////////////////////////////////////
-		int min_pos = constant_sequence_begin_pos - seqid_length + 1;
-		if (min_pos < 0)	 min_pos = 0;
-		String<char> sequence_id_region_in_sequence1 = infixWithLength( seq1, min_pos, seqid_length);
-		// We append the primer binding site to make sure that the search will be over actual barcode regions (adjoining the constant sequence) from the RNA library.
-		append(sequence_id_region_in_sequence1,cseq);
+	if ( profile ) output_profile_report( profile_times, num_threads, align_time, outpath );
 
-		// Start by looking for exact match of sequence ID in read 1, and then look for match in read 2.
-		//   If that doesn't work, can try single nucleotide variants later...
-		bool found_match_in_read1( false ), found_match_in_read2( false );
-		std::vector< unsigned > possible_sids, possible_begpos;
-		find_possible_sids( possible_sids, possible_begpos, finder_sequence_id, sequence_id_region_in_sequence1 );
+	if ( binary_output ) {
+		std::string const stats_outFileName = outpath + "stats.bin";
+		std::cout << std::endl << "Outputting counts to: " << stats_outFileName << std::endl;
+		if ( !write_count_file( all_count, expt_id_names, sequence_names, stats_outFileName, compress_output ) ) exit( 0 );
+	} else if ( sparse_output ) {
+		output_sparse_stats_files( all_count, outpath, "stats" );
+	} else {
+		output_stats_files( all_count, outpath, "stats" );
+	}
+	//    output_stats_files( all_count_strict, outpath, "strict_stats" );
 
-		// ambiguous assignments. [should not occur if n (seqid_length) is set large enough.]
-		if ( possible_sids.size() > 1 )	disambiguate_possible_sids( possible_sids, possible_begpos, min_pos, seq1, RNA_sequences );
+	return 1;
+}
 
-		// this might be a really short read -- can check this by looking for the appearance of the other
-		// Illumina adapter sequence which should be ligated onto the 3' end.
-		bool verbose( false );
-		if ( align_all && possible_sids.size() == 0 )  check_for_short_insert( adapterSequence2, cseq, constant_sequence_begin_pos, seqid_length,
-																																					 seq1, finder_sequence_id, possible_sids, align_null, verbose, nullLigation );
+////////////////////////////////////////////////////////////////
+// Goes through the whole cascade for one read pair -- primer binding site, then experimental ID,
+// then sequence ID in read 1, then the reverse transcription stop in read 2 -- and records the
+// result in the worker's counts. Only touches the worker, so different threads can call this at once.
+// With --dedup, multiplicity is how many copies of the read pair there were.
+void
+align_read_pair( CharString & seq1,
+								 CharString & seq2,
+								 AlignmentSetup & setup,
+								 AlignmentWorker & worker,
+								 unsigned const multiplicity )
+{
+	CharString & cseq = setup.cseq;
+	unsigned const & seqid_length = setup.seqid_length;
 
+	reverseComplement(seq1);
 
-		// there was originally a different logic for this, where MAPseeker had a while loop that went through
-		// every single nt variant until finding a hit. The following is slower, testing every variant -- might
-		// still be useful for testing and is less biased. Anyway, currently match_single_nt_variants
-		// is not in use by default, and turning it on doesn't get us more than ~5-10% more aligned reads.
-		if ( possible_sids.size() == 0 && match_single_nt_variants ){
-			CharString sequence_id_region_variant( sequence_id_region_in_sequence1 );
-			unsigned variant_counter( 1 );
-			while ( get_next_variant( sequence_id_region_in_sequence1, sequence_id_region_variant, variant_counter, seqid_length ) ){
-				find_possible_sids( possible_sids, possible_begpos, finder_sequence_id, sequence_id_region_variant );
+	ScopedProfileTimer read_pair_timer( worker.profile, READ_PAIR_STAGE );
+
+	PurificationTable & purification = worker.purification;
+	record_counter( purification, TOTAL_COUNTER, -1, multiplicity );
+
+	AlignmentScratch & scratch = worker.scratch;
+
+	int pos1( -1 ), constant_sequence_begin_pos( -1 ), expt_idx( -1 );
+
+	///////////////////////////////////////////////////////////////////////////////////////////
+	// Look for the constant region (primer binding site) -- JP's trick.
+	// In future could do multi-pattern search for multiple primers ... in that
+	// case, we'll have to rewrite this code unfortunately.
+	///////////////////////////////////////////////////////////////////////////////////////////
+	unsigned perfect( 0 );
+	//pos1 = try_exact_match( seq1, cseq, perfect );  //  interesting -- DPsearch (see next) is no slower than available exact matches.
+	{
+		ScopedProfileTimer timer( worker.profile, PRIMER_SITE_STAGE );
+		if ( pos1 < 0 ) pos1 = try_DP_match( seq1, worker.match_context.cseq_pattern, perfect ); // allows for 1 mismatch, 2 deletions
+	}
+	if ( perfect ) record_counter( purification, PERFECT_COUNTER, -1, multiplicity );
+	if ( pos1 < 0 ) return;
+	addProfileStageHit( worker.profile, PRIMER_SITE_STAGE );
+	record_counter( purification, PRIMER_SITE_COUNTER, -1, multiplicity );
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Look for experimental ID (expt ID that follows constant primer binding site, and is coded by reverse transcription primer)
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// first look for exact match -- should be super-fast, as using index.
+	{
+		ScopedProfileTimer timer( worker.profile, EXPT_ID_STAGE );
+		CharString & expt_id_in_read1 = scratch.expt_id_in_read1;
+		expt_id_in_read1 = suffix(seq1,(pos1+1));
+		if ( setup.expt_id_classifier.enabled ) {
+			// exact match, or up to 2 edits, looked up in tables precomputed from the index & DP search below.
+			expt_idx = classify_expt_id( setup.expt_id_classifier, expt_id_in_read1 );
+		} else {
+			if ( find( worker.finder_expt_id, expt_id_in_read1 ) )	{
+				expt_idx = beginPosition(worker.finder_expt_id).i1;
 			}
+			clear( worker.finder_expt_id );
+
+			if ( expt_idx < 0) expt_idx = try_DP_match_expt_ids( worker.match_context.expt_id_patterns, expt_id_in_read1 );
 		}
+	}
 
-		// Should be a class...
-		// check for 'junk' -- random nts at 3' end of RNA added by T7 polymerase.
-		// specified by user as sequence with '*' in the middle. See above for fasta readin.
-		bool extra_junk_mode( false );
-		std::vector< CharString > sequences_with_extra_junk;
-		if ( possible_sids.size() == 0 )  check_for_extra_junk_using_star_sequences( possible_sids, sequences_with_extra_junk, extra_junk_mode,
-																																								 finder_sequence_id, seq1, constant_sequence_begin_pos,
-																																								 sequences_before_star, sequences_after_star, star_sequence_ids );
-
-		// "hail mary"
-		if ( align_all && possible_sids.size() == 0 )  {
-			for ( unsigned s = 0; s < star_sequence_ids.size(); s++ ) possible_sids.push_back( star_sequence_ids[ s ] );
+	// this avoids findBegin, but assumes no indels in constant primer binding sequence
+	if ( constant_sequence_begin_pos < 0 ) constant_sequence_begin_pos = pos1 - length( cseq);
+
+	if( expt_idx < 0 ) return;
+	addProfileStageHit( worker.profile, EXPT_ID_STAGE );
+	record_counter( purification, EXPT_ID_COUNTER, expt_idx, multiplicity );
+
+	////////////////////////////////////////////////////////////////////////////////////////
+	// Look for the sequence ID (i.e., the identifier sequence at the 3' end of the RNA)
+	// in a region of seqid nucleotides before the constant (primer-binding) site.
+	// seqid is the (minimum) length of the barcode...
+	////////////////////////////////////////////////////////////////////////////////////////
+	int min_pos = constant_sequence_begin_pos - seqid_length + 1;
+	if (min_pos < 0)	 min_pos = 0;
+	CharString & sequence_id_region_in_sequence1 = scratch.sequence_id_region_in_sequence1;
+	sequence_id_region_in_sequence1 = infixWithLength( seq1, min_pos, seqid_length);
+	// We append the primer binding site to make sure that the search will be over actual barcode regions (adjoining the constant sequence) from the RNA library.
+	append(sequence_id_region_in_sequence1,cseq);
+
+	// Start by looking for exact match of sequence ID in read 1, and then look for match in read 2.
+	//   If that doesn't work, can try single nucleotide variants later...
+	std::vector< unsigned > & possible_sids = scratch.possible_sids, & possible_begpos = scratch.possible_begpos;
+	possible_sids.clear();
+	possible_begpos.clear();
+	{
+		ScopedProfileTimer timer( worker.profile, SEQUENCE_ID_STAGE );
+		if ( setup.sequence_id_table.enabled ) {
+			find_possible_sids( possible_sids, possible_begpos, setup.sequence_id_table, sequence_id_region_in_sequence1 );
+		} else {
+			find_possible_sids( possible_sids, possible_begpos, worker.finder_sequence_id, sequence_id_region_in_sequence1 );
 		}
 
+		// ambiguous assignments. [should not occur if n (seqid_length) is set large enough.]
+		if ( possible_sids.size() > 1 )	disambiguate_possible_sids( possible_sids, possible_begpos, min_pos, seq1, setup.RNA_sequences );
+	}
+	if ( possible_sids.size() > 0 ) addProfileStageHit( worker.profile, SEQUENCE_ID_STAGE );
+
+	// this might be a really short read -- can check this by looking for the appearance of the other
+	// Illumina adapter sequence which should be ligated onto the 3' end.
+	bool verbose( false );
+	if ( setup.align_all && possible_sids.size() == 0 ) {
+		ScopedProfileTimer timer( worker.profile, SHORT_INSERT_STAGE );
+		unsigned null_ligation( 0 );
+		check_for_short_insert( worker.match_context.adapter2_patterns, cseq, constant_sequence_begin_pos, seqid_length,
+														seq1, worker.finder_sequence_id, possible_sids, scratch.sequence_id_in_read1, setup.align_null, verbose, null_ligation );
+		if ( null_ligation ) record_counter( purification, NULL_LIGATION_COUNTER, expt_idx, multiplicity );
+		if ( possible_sids.size() > 0 ) addProfileStageHit( worker.profile, SHORT_INSERT_STAGE );
+	}
+
 
-		if ( verbose ){
-			std::cout << "possible_sids" << std::endl;
-			for ( int i = 0; i < possible_sids.size(); i++ ) std::cout << " " << possible_sids[i];
-			std::cout << std::endl;
+	// there was originally a different logic for this, where MAPseeker had a while loop that went through
+	// every single nt variant until finding a hit. The following is slower, testing every variant -- might
+	// still be useful for testing and is less biased. Anyway, currently match_single_nt_variants
+	// is not in use by default, and turning it on doesn't get us more than ~5-10% more aligned reads.
+	if ( possible_sids.size() == 0 && setup.match_single_nt_variants ){
+		ScopedProfileTimer timer( worker.profile, SINGLE_NT_VARIANT_STAGE );
+		if ( setup.sequence_id_table.enabled ) {
+			// all the variants at once.
+			find_possible_sids_in_variants( possible_sids, possible_begpos, setup.sequence_id_table, sequence_id_region_in_sequence1 );
+		} else {
+			CharString & sequence_id_region_variant = scratch.sequence_id_region_variant;
+			sequence_id_region_variant = sequence_id_region_in_sequence1;
+			unsigned variant_counter( 1 );
+			while ( get_next_variant( sequence_id_region_in_sequence1, sequence_id_region_variant, variant_counter, seqid_length ) ){
+				find_possible_sids( possible_sids, possible_begpos, worker.finder_sequence_id, sequence_id_region_variant );
+			}
 		}
-		if ( possible_sids.size() == 0 ) continue;
+		if ( possible_sids.size() > 0 ) addProfileStageHit( worker.profile, SINGLE_NT_VARIANT_STAGE );
+	}
 
-		record_counter( "found match in RNA sequence (read 1)", counter_idx, counter_counts, counter_tags );
-		found_match_in_read1 = true;
+	// Should be a class...
+	// check for 'junk' -- random nts at 3' end of RNA added by T7 polymerase.
+	// specified by user as sequence with '*' in the middle. See above for fasta readin.
+	bool extra_junk_mode( false );
+	std::vector< CharString > & sequences_with_extra_junk = scratch.sequences_with_extra_junk;
+	if ( possible_sids.size() == 0 ) {
+		ScopedProfileTimer timer( worker.profile, STAR_JUNK_STAGE );
+		check_for_extra_junk_using_star_sequences( possible_sids, sequences_with_extra_junk, extra_junk_mode,
+																							 worker.star_anchor_pattern, worker.match_context.star_anchor_idx, scratch.star_anchor_end_pos,
+																							 seq1, constant_sequence_begin_pos,
+																							 setup.sequences_before_star, setup.sequences_after_star, setup.star_sequence_ids );
+		if ( possible_sids.size() > 0 ) addProfileStageHit( worker.profile, STAR_JUNK_STAGE );
+	}
+
+	// "hail mary"
+	if ( setup.align_all && possible_sids.size() == 0 )  {
+		ScopedProfileTimer timer( worker.profile, HAIL_MARY_STAGE );
+		for ( unsigned s = 0; s < setup.star_sequence_ids.size(); s++ ) possible_sids.push_back( setup.star_sequence_ids[ s ] );
+		if ( possible_sids.size() > 0 ) addProfileStageHit( worker.profile, HAIL_MARY_STAGE );
+	}
 
-		std::vector< unsigned > mpos_vector, sid_vector;
-		int mscr( 0 );
 
-		for ( unsigned s = 0; s < possible_sids.size(); s++ ){
+	if ( verbose ){
+		std::cout << "possible_sids" << std::endl;
+		for ( int i = 0; i < possible_sids.size(); i++ ) std::cout << " " << possible_sids[i];
+		std::cout << std::endl;
+	}
+	if ( possible_sids.size() == 0 ) return;
+
+	record_counter( purification, READ1_COUNTER, expt_idx, multiplicity );
+
+	std::vector< unsigned > & mpos_vector = scratch.mpos_vector, & sid_vector = scratch.sid_vector;
+	mpos_vector.clear();
+	sid_vector.clear();
+	int mscr( 0 );
+
+	ScopedProfileTimer read2_timer( worker.profile, READ2_STAGE );
+	// the RT stop is given by where read 2 begins, so its first nts are enough to place it.
+	if ( setup.read2_length > 0 && length( seq2 ) > setup.read2_length ) resize( seq2, setup.read2_length );
+	int min_fragment_length( 0 ), max_fragment_length( -1 );
+	if ( setup.read2_window > 0 ) get_fragment_length_in_read1( worker.match_context.adapter2_patterns, seq1, constant_sequence_begin_pos, seqid_length,
+																															 min_fragment_length, max_fragment_length );
+	// extra junk sequences come from read 1, so those placements can't be reused; nor can ones limited by read 1.
+	bool const use_read2_cache = ( setup.read2_cache.enabled && !extra_junk_mode && setup.read2_window == 0 );
+	if ( !use_read2_cache || !find_cached_read2_placements( setup.read2_cache, possible_sids, expt_idx, seq2, mpos_vector, sid_vector, mscr ) ) {
+		record_counter( purification, READ2_SEARCH_COUNTER, expt_idx, multiplicity );
+		if ( find_read2_placements( seq2, possible_sids, sequences_with_extra_junk, extra_junk_mode, expt_idx, setup,
+																min_fragment_length, max_fragment_length, mpos_vector, sid_vector, mscr, scratch, verbose ) ) {
+			record_counter( purification, READ2_SEED_COUNTER, expt_idx, multiplicity );
+		}
+		if ( use_read2_cache ) cache_read2_placements( setup.read2_cache, possible_sids, expt_idx, seq2, mpos_vector, sid_vector, mscr );
+	}
+	read2_timer.stop();
+
+	if ( mpos_vector.size() == 0 ) return;
+	addProfileStageHit( worker.profile, READ2_STAGE );
+	addProfileStageHit( worker.profile, READ_PAIR_STAGE );
+
+	record_counter( purification, READ2_COUNTER, expt_idx, multiplicity );
+	if ( mscr == 0 ) record_counter( purification, STRICT_COUNTER, expt_idx, multiplicity );
+
+	float const weight = 1.0 / mpos_vector.size();
+	for (unsigned q = 0; q < mpos_vector.size(); q++ ){
+		int sid_idx = sid_vector[q];
+		int mpos    = mpos_vector[q];
+		if ( verbose ) std::cout << "READ2 " << mpos << " " << sid_idx << std::endl;
+		if ( mpos < 0 ) mpos = 0;
+		add_count( worker.all_count, expt_idx, sid_idx, mpos, weight, multiplicity );
+		//	if ( mscr == 0 ) all_count_strict[ expt_idx ][ sid_idx ][ mpos ] += weight;
+	}
+}
 
-			// seq_from_library contains the RNA library sequences
-			unsigned sid_idx = possible_sids[ s ];
+////////////////////////////////////////////////////////////////////////////////////////
+// Look for the second read to determine where the reverse transcription stop is, in each possible
+// RNA sequence [plus the expt ID and adapter added by the RT primer]. Keeps all the placements with
+// the best score, which ends up in mscr; none if nothing is within the edit distance cutoff.
+// Returns true if read 2 got placed by its seed, without searching [see place_read2_by_seed()].
+bool
+find_read2_placements( CharString & seq2,
+											 std::vector< unsigned > const & possible_sids,
+											 std::vector< CharString > const & sequences_with_extra_junk,
+											 bool const extra_junk_mode,
+											 int const expt_idx,
+											 AlignmentSetup & setup,
+											 int const min_fragment_length,
+											 int const max_fragment_length,
+											 std::vector< unsigned > & mpos_vector,
+											 std::vector< unsigned > & sid_vector,
+											 int & mscr,
+											 AlignmentScratch & scratch,
+											 bool const verbose )
+{
+	// read 2 is the same for every possible reference, so it only gets preprocessed once.
+	if ( setup.match_DP ){
+		//Set options for match, mismatch, gap. Again, should make these variables.
+		setScoringScheme( scratch.read2_DP_pattern, SimpleScore( 0, -2, -1 ) );
+		setHost( scratch.read2_DP_pattern, seq2 );
+		setScoreLimit( scratch.read2_DP_pattern, -4 );
+	} else {
+		setHost( scratch.read2_pattern, seq2 );
+		setScoreLimit( scratch.read2_pattern, setup.strict ? 0 : -2 ); //Edit Distance used to be -10! not very stringent.
+	}
 
+	// the possible references, and how far into each one an RT stop can be.
+	unsigned const num_references = possible_sids.size();
+	std::vector< CharString * > & references = scratch.references;
+	std::vector< int > & mpos_max = scratch.mpos_max, & cseq_pos = scratch.cseq_pos;
+	references.resize( num_references );
+	mpos_max.resize( num_references );
+	cseq_pos.resize( num_references );
+	if ( scratch.reference_buffers.size() < num_references ) scratch.reference_buffers.resize( num_references ); // before taking pointers into it.
+	for ( unsigned s = 0; s < num_references; s++ ){
+
+		// seq_from_library contains the RNA library sequences
+		unsigned sid_idx = possible_sids[ s ];
+
+		if ( !extra_junk_mode && setup.reference_arena.enabled ){
+			// built once at startup.
+			ReferenceArena & arena = setup.reference_arena;
+			size_t const n = size_t( sid_idx ) * arena.num_expt_ids + expt_idx;
+			references[ s ] = &arena.references[ n ];
+			mpos_max[ s ] = arena.mpos_max[ n ];
+			cseq_pos[ s ] = arena.cseq_pos[ n ];
+		} else {
+			CharString & seq_from_library = scratch.reference_buffers[ s ];
 			// what is the DNA?
 			if ( !extra_junk_mode ){
-				seq_from_library = RNA_sequences[ sid_idx ];
+				seq_from_library = setup.RNA_sequences[ sid_idx ];
 			} else {
 				seq_from_library = sequences_with_extra_junk[ s ];
 			}
-			append( seq_from_library, short_expt_ids[ expt_idx ] ); // experimental ID, added in MAP-seq protocol as part of reverse transcription primer
-			append( seq_from_library, adapterSequenceRC ); // piece of illumina DNA, added in MAP-seq protocol as part of reverse transcription primer
-
-			////////////////////////////////////////////////////////////////////////////////////////
-			// Look for the second read to determine where the reverse transcription stop is.
-			////////////////////////////////////////////////////////////////////////////////////////
-			Finder<String<char> > finder_in_specific_sequence(seq_from_library);
-
-			//reads beyond sequence ID are nonsense -- sequence ID better be there based on match to read1 above.
-			int mpos_max = try_exact_match( seq_from_library, cseq ) - seqid_length;
-			if ( align_all  ) mpos_max = try_exact_match( seq_from_library, cseq ) - 1;
-			if ( align_null ) mpos_max = try_exact_match( seq_from_library, cseq ) - 1;  	  // allows for null ligations!
-			if ( mpos_max < 0 ) mpos_max = length( seq_from_library );  //to catch boundary cases -- no match to constant sequence.
-			if ( mpos_max > max_rna_len ) mpos_max = max_rna_len;
-
-			if ( match_DP ){
-				//Set options for match, mismatch, gap. Again, should make these variables.
-				Pattern<String<char>, DPSearch<SimpleScore> >  pattern_in_specific_sequence (seq2,SimpleScore(0, -2, -1));
-				int EDIT_DISTANCE_SCORE_CUTOFF( -4 );
-				setScoreLimit(pattern_in_specific_sequence, EDIT_DISTANCE_SCORE_CUTOFF);
-
-				if ( mpos_vector.size() == 0 ) mscr = EDIT_DISTANCE_SCORE_CUTOFF - 1;
-				// Here, looking for best score -- but assuming that we've nailed the right RNA sequence (which may not be the case).
-				while (find(finder_in_specific_sequence, pattern_in_specific_sequence)) {
-					int cscr = getScore(pattern_in_specific_sequence);
-					if(cscr > mscr) {
+			append( seq_from_library, setup.short_expt_ids[ expt_idx ] ); // experimental ID, added in MAP-seq protocol as part of reverse transcription primer
+			append( seq_from_library, setup.adapterSequenceRC ); // piece of illumina DNA, added in MAP-seq protocol as part of reverse transcription primer
+			references[ s ] = &seq_from_library;
+			mpos_max[ s ] = get_mpos_max( seq_from_library, setup );
+			cseq_pos[ s ] = ( setup.read2_window > 0 ) ? try_exact_match( seq_from_library, setup.cseq ) : -1;
+		}
+	}
+
+	// RT stops can't be past last_mpos, and with --read2_window, read 2 gets searched for only from window_begin on.
+	std::vector< int > & window_begin = scratch.window_begin, & last_mpos = scratch.last_mpos;
+	window_begin.assign( num_references, 0 );
+	last_mpos.assign( mpos_max.begin(), mpos_max.end() );
+	if ( setup.read2_window > 0 ){
+		for ( unsigned s = 0; s < num_references; s++ ){
+			if ( cseq_pos[ s ] < 0 ) continue;
+			// the fragment ends right before the primer binding site.
+			int const slack = setup.read2_window;
+			last_mpos[ s ] = std::min( last_mpos[ s ], cseq_pos[ s ] - min_fragment_length + slack );
+			if ( max_fragment_length >= 0 ) window_begin[ s ] = std::max( 0, cseq_pos[ s ] - max_fragment_length - slack - 1 );
+		}
+	}
+
+	if ( !extra_junk_mode && setup.read2_seed_index.enabled && !verbose &&
+			 place_read2_by_seed( seq2, possible_sids, expt_idx, setup, window_begin, last_mpos, mpos_vector, sid_vector, mscr, scratch ) ) return true;
+
+	// With several references, first score read 2 against all of them at once [see MAPseeker_myers_simd.h].
+	// References where it can't do at least as well as the best placements so far get skipped -- nothing
+	// in search_read2_in_reference() would change for them.
+	bool const prescreen = ( !setup.match_DP && num_references > 1 && setup.myers_kernel != SCALAR_MYERS_KERNEL &&
+													 setup_multi_text_myers_pattern( scratch.read2_multi_text_pattern, seq2 ) );
+	if ( prescreen ){
+		scratch.best_errors.resize( num_references );
+		scratch.best_end.resize( num_references );
+		find_best_in_texts( scratch.read2_multi_text_pattern, &references[ 0 ], num_references, setup.myers_kernel,
+												&scratch.best_errors[ 0 ], &scratch.best_end[ 0 ] );
+	}
+
+	// An alignment of read 2 with up to max_errors edits spans at most length( seq2 ) + max_errors nts of the reference,
+	// so placements past last_mpos must end before window_end. With Myers, hits past mpos_max never change
+	// anything, so the rest of the reference [the end of the RNA, expt ID, adapter] doesn't get searched. With DP,
+	// they can still set mscr, so the whole reference gets searched -- unless read 1 narrows it down [--read2_window].
+	int const max_errors = setup.match_DP ? -scoreLimit( scratch.read2_DP_pattern ) : -scoreLimit( scratch.read2_pattern );
+	for ( unsigned s = 0; s < num_references; s++ ){
+		unsigned sid_idx = possible_sids[ s ];
+		int const reference_length = length( *references[ s ] );
+		int window_end( reference_length );
+		if ( !setup.match_DP || setup.read2_window > 0 ) window_end = std::min( window_end, last_mpos[ s ] + int( length( seq2 ) ) + max_errors + 1 );
+		CharString * reference = references[ s ];
+		if ( window_begin[ s ] > 0 || window_end < reference_length ){
+			if ( window_end <= window_begin[ s ] ) window_end = window_begin[ s ];
+			scratch.read2_window = infix( *reference, window_begin[ s ], window_end );
+			reference = &scratch.read2_window;
+		}
+
+		bool skip( false );
+		if ( prescreen ){
+			int const cutoff = scoreLimit( scratch.read2_pattern );
+			if ( mpos_vector.size() == 0 ) mscr = cutoff - 1; // as in search_read2_in_reference().
+			int const best_score = -int( scratch.best_errors[ s ] );
+			skip = ( best_score < cutoff || best_score < mscr );
+		}
+		if ( !skip ) search_read2_in_reference( *reference, window_begin[ s ], last_mpos[ s ], sid_idx, seq2, scratch.read2_pattern, scratch.read2_DP_pattern,
+																						setup, mpos_vector, sid_vector, mscr, verbose );
+		if (verbose )  std::cout << "in read 2, checking " << sid_idx << ": " << sid_vector.size() << " " << seq2 << " [ score: " << mscr << " ] " << std::endl;
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Fast path for read 2 [see MAPseeker_read2_seed.h]. If it occurs exactly in one of the possible references,
+// the Myers search ends up with a score of 0, and keeps placements that follow from where those occurrences
+// begin. Returns false, with nothing changed, if read 2 has to be searched for after all.
+//
+// The first exact occurrence the search comes to [in order of references, then of positions] has a hit with one
+// edit right before it, ending one nt earlier -- so its begin gets found with a score limit of -1, which puts mpos
+// at its first nt. That hit only counts if its mpos, at most the occurrence's begin + 1, is within mpos_max, so
+// an occurrence that begins right at mpos_max needs the search [unless --strict, where the limit is -1 anyway].
+// Once the score is 0, the limit is 0 too, which puts mpos one nt before each further occurrence.
+//
+// With --read2_window, the search only sees the reference from window_begin on, and mpos_max is cut down to
+// the window too. Occurrences that end before window_begin can't be found, so are left out; ones that begin
+// right around window_begin need the search, which may see them only in part.
+bool
+place_read2_by_seed( CharString & seq2,
+										 std::vector< unsigned > const & possible_sids,
+										 int const expt_idx,
+										 AlignmentSetup & setup,
+										 std::vector< int > const & window_begin,
+										 std::vector< int > const & mpos_max,
+										 std::vector< unsigned > & mpos_vector,
+										 std::vector< unsigned > & sid_vector,
+										 int & mscr,
+										 AlignmentScratch & scratch )
+{
+	Read2SeedIndex const & index = setup.read2_seed_index;
+	ReferenceArena const & arena = setup.reference_arena;
+	int const read2_length = length( seq2 );
+	__uint64 seed;
+	if ( read2_length < 2 || !pack_read2_seed( seed, seq2, 0, index.seed_length ) ) return false;
+
+	// exact occurrences of all of read 2 where an RT stop could count, in order of sequence ID, then position.
+	std::vector< std::pair< unsigned, int > > & seed_hits = scratch.read2_seed_hits;
+	seed_hits.clear();
+	unsigned const bucket = get_read2_seed_bucket( index, seed );
+	for ( unsigned i = index.bucket_begin[ bucket ]; i < index.bucket_begin[ bucket + 1 ]; i++ ){
+		Read2SeedEntry const & entry = index.entries[ i ];
+		if ( entry.seed != seed || ( entry.expt_idx >= 0 && entry.expt_idx != expt_idx ) ) continue;
+		size_t const n = size_t( entry.sid ) * arena.num_expt_ids + expt_idx;
+		CharString const & reference = arena.references[ n ];
+		if ( entry.pos > arena.mpos_max[ n ] + 1 || entry.pos + read2_length > int( length( reference ) ) ) continue;
+		int i2 = index.seed_length;
+		while ( i2 < read2_length && seq2[ i2 ] == reference[ entry.pos + i2 ] ) i2++;
+		if ( i2 == read2_length ) seed_hits.push_back( std::make_pair( entry.sid, entry.pos ) );
+	}
+	if ( seed_hits.size() == 0 ) return false;
+
+	for ( unsigned s = 0; s < possible_sids.size(); s++ ){
+		if ( window_begin[ s ] == 0 ) continue;
+		for ( unsigned h = 0; h < seed_hits.size(); h++ ){
+			if ( seed_hits[ h ].first != possible_sids[ s ] ) continue;
+			int const begin = seed_hits[ h ].second;
+			if ( begin < window_begin[ s ] + 2 && begin + read2_length > window_begin[ s ] ) return false;
+		}
+	}
+
+	bool placed( false );
+	for ( unsigned s = 0; s < possible_sids.size(); s++ ){
+		unsigned const sid_idx = possible_sids[ s ];
+		for ( unsigned h = 0; h < seed_hits.size(); h++ ){
+			if ( seed_hits[ h ].first != sid_idx ) continue;
+			int const begin = seed_hits[ h ].second;
+			if ( begin < window_begin[ s ] ) continue;
+			if ( !placed ){
+				if ( begin > mpos_max[ s ] ) continue;
+				if ( begin == mpos_max[ s ] && !setup.strict ) return false;
+				mpos_vector.clear();
+				sid_vector.clear();
+				mpos_vector.push_back( begin );
+				sid_vector.push_back( sid_idx );
+				mscr = 0;
+				placed = true;
+			} else if ( begin - 1 <= mpos_max[ s ] && !already_saved( mpos_vector, sid_vector, begin - 1, sid_idx ) ){
+				mpos_vector.push_back( begin - 1 );
+				sid_vector.push_back( sid_idx );
+			}
+		}
+	}
+	return placed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// how far into the reference [RNA + expt ID + adapter] an RT stop can be:
+// reads beyond sequence ID are nonsense -- sequence ID better be there based on match to read1 above.
+int
+get_mpos_max( CharString & seq_from_library, AlignmentSetup & setup ){
+	int const cseq_pos = try_exact_match( seq_from_library, setup.cseq );
+	int mpos_max = cseq_pos - int( setup.seqid_length );
+	if ( setup.align_all || setup.align_null ) mpos_max = cseq_pos - 1; // allows for null ligations!
+	if ( mpos_max < 0 ) mpos_max = length( seq_from_library );  //to catch boundary cases -- no match to constant sequence.
+	if ( mpos_max > int( setup.max_rna_len ) ) mpos_max = setup.max_rna_len;
+	return mpos_max;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Look for the second read in one reference, keeping the placements that tie for the best score so far.
+// The patterns for read 2 [with their score cutoffs] come set up from find_read2_placements(). The reference
+// may be only the part of it from window_begin on; placements are still given in the whole reference.
+void
+search_read2_in_reference( CharString & reference,
+													 int const window_begin,
+													 int const mpos_max,
+													 unsigned const sid_idx,
+													 CharString & seq2,
+													 TRead2Pattern & read2_pattern,
+													 TDPPattern & read2_DP_pattern,
+													 AlignmentSetup & setup,
+													 std::vector< unsigned > & mpos_vector,
+													 std::vector< unsigned > & sid_vector,
+													 int & mscr,
+													 bool const verbose )
+{
+	Finder<String<char> > finder_in_specific_sequence( reference );
+
+	if ( setup.match_DP ){
+		TDPPattern & pattern_in_specific_sequence = read2_DP_pattern;
+		int EDIT_DISTANCE_SCORE_CUTOFF = scoreLimit( pattern_in_specific_sequence );
+
+		if ( mpos_vector.size() == 0 ) mscr = EDIT_DISTANCE_SCORE_CUTOFF - 1;
+		// Here, looking for best score -- but assuming that we've nailed the right RNA sequence (which may not be the case).
+		while (find(finder_in_specific_sequence, pattern_in_specific_sequence)) {
+			int cscr = getScore(pattern_in_specific_sequence);
+			if(cscr > mscr) {
+				mscr=cscr;
+				mpos_vector.clear();
+				sid_vector.clear();
+			}
+			if ( cscr == mscr ){ // in case of ties, keep track of all hits
+				findBegin( finder_in_specific_sequence, pattern_in_specific_sequence, mscr ); // the proper thing to do if DP is used.
+				unsigned mpos = window_begin + beginPosition( finder_in_specific_sequence );
+				//std::cout << "FOUND IT " << cscr << " " << mscr << " " << mpos << " " << mpos_max << std::endl;
+				if ( mpos <= unsigned( mpos_max ) ) {
+					mpos_vector.push_back( mpos );
+					sid_vector.push_back( sid_idx );
+				}
+			}
+		}
+
+	} else {  // default -- use fast MyersUkkonen [approximate search]
+		// following copies code from DP block. Can't figure out how to avoid this -- Pattern is not sub-classed,
+		// so Pattern< MyersUkkonen> cannot be interchanged with Pattern< DPsearch >. --Rhiju
+		// Alternative to DP -- edit distance, used by JP
+		//	  Pattern<String<char>, Myers<  AlignTextBanded< FindInfix, NMatchesN_, NMatchesN_> > > pattern_in_specific_sequence(seq2);
+		TRead2Pattern & pattern_in_specific_sequence = read2_pattern;
+		int EDIT_DISTANCE_SCORE_CUTOFF = scoreLimit( pattern_in_specific_sequence );
+
+		if ( mpos_vector.size() == 0 ) mscr = EDIT_DISTANCE_SCORE_CUTOFF - 1;
+
+		// Here, looking for best score -- but assuming that we've nailed the right RNA sequence (which may not be the case).
+		while (find(finder_in_specific_sequence, pattern_in_specific_sequence)) {
+			int cscr = getScore(pattern_in_specific_sequence);
+			if ( cscr >= mscr ){ // in case of ties, keep track of all hits
+				findBegin( finder_in_specific_sequence, pattern_in_specific_sequence, mscr );
+				int mpos = window_begin + int(beginPosition( finder_in_specific_sequence )) - 1; // the -1 appears necessary for myers beginPos. Sigh.
+				//	      if ( sid_idx >= 200 && mpos > 180 ) { if (!verbose) { std::cout << std::endl; verbose = true;} }
+				if ( verbose ) std::cout << "check: " << mpos << " gives score " << cscr << std::endl;
+				// watch out ... this can't go beyond the "sequence id"!?
+				//std::cout << mpos << " " << mpos_max << std::endl;
+				if ( mpos <= mpos_max ) {
+					if(cscr > mscr){
 						mscr=cscr;
 						mpos_vector.clear();
 						sid_vector.clear();
 					}
-					if ( cscr == mscr ){ // in case of ties, keep track of all hits
-						findBegin( finder_in_specific_sequence, pattern_in_specific_sequence, mscr ); // the proper thing to do if DP is used.
-						unsigned mpos = beginPosition( finder_in_specific_sequence );
-						//std::cout << "FOUND IT " << cscr << " " << mscr << " " << mpos << " " << mpos_max << std::endl;
-						if ( mpos <= unsigned( mpos_max ) ) {
-							mpos_vector.push_back( mpos );
-							sid_vector.push_back( sid_idx );
-						}
-					}
-				}
-
-			} else {  // default -- use fast MyersUkkonen [approximate search]
-				// following copies code from DP block. Can't figure out how to avoid this -- Pattern is not sub-classed,
-				// so Pattern< MyersUkkonen> cannot be interchanged with Pattern< DPsearch >. --Rhiju
-				// Alternative to DP -- edit distance, used by JP
-				//	  Pattern<String<char>, Myers<  AlignTextBanded< FindInfix, NMatchesN_, NMatchesN_> > > pattern_in_specific_sequence(seq2);
-				Pattern<String<char>, Myers< FindInfix > > pattern_in_specific_sequence(seq2);
-				int EDIT_DISTANCE_SCORE_CUTOFF( strict ? 0 : -2 );
-				setScoreLimit(pattern_in_specific_sequence, EDIT_DISTANCE_SCORE_CUTOFF);//Edit Distance used to be -10! not very stringent.
-
-				if ( mpos_vector.size() == 0 ) mscr = EDIT_DISTANCE_SCORE_CUTOFF - 1;
-
-				// Here, looking for best score -- but assuming that we've nailed the right RNA sequence (which may not be the case).
-				while (find(finder_in_specific_sequence, pattern_in_specific_sequence)) {
-					int cscr = getScore(pattern_in_specific_sequence);
-					if ( cscr >= mscr ){ // in case of ties, keep track of all hits
-						findBegin( finder_in_specific_sequence, pattern_in_specific_sequence, mscr );
-						int mpos = int(beginPosition( finder_in_specific_sequence )) - 1; // the -1 appears necessary for myers beginPos. Sigh.
-						//	      if ( sid_idx >= 200 && mpos > 180 ) { if (!verbose) { std::cout << std::endl; verbose = true;} }
-						if ( verbose ) std::cout << "check: " << mpos << " gives score " << cscr << std::endl;
-						// watch out ... this can't go beyond the "sequence id"!?
-						//std::cout << mpos << " " << mpos_max << std::endl;
-						if ( mpos <= mpos_max ) {
-							if(cscr > mscr){
-								mscr=cscr;
-								mpos_vector.clear();
-								sid_vector.clear();
-							}
-							if ( !already_saved( mpos_vector, sid_vector, mpos, sid_idx ) ){
-								mpos_vector.push_back( mpos );
-								sid_vector.push_back( sid_idx );
-							}
-						}
+					if ( !already_saved( mpos_vector, sid_vector, mpos, sid_idx ) ){
+						mpos_vector.push_back( mpos );
+						sid_vector.push_back( sid_idx );
 					}
 				}
 			}
-			if ( verbose ) std::cout << "pattern: " << seq2 << " vs finder " << seq_from_library << std::endl;
-			if (verbose )  std::cout << "in read 2, checking " << sid_idx << ": " << sid_vector.size() << " " << seq1 << " " << seq2 << " [ score: " << mscr << " ] " << std::endl;
-			//std::cout << "mpos_vector.size(): " << mpos_vector.size() << ", seq2: " << seq2 << std::endl;
 		}
+	}
+	if ( verbose ) std::cout << "pattern: " << seq2 << " vs finder " << reference << std::endl;
+}
 
-		if ( mpos_vector.size() == 0 ) continue;
+////////////////////////////////////////////////////////////////
+// for batches holding views into a memory-mapped file -- align_read_pair()
+// modifies the sequences, so copy them into the worker's buffers first.
+template < typename TSeqView >
+void
+align_read_pair( TSeqView const & seq1,
+								 TSeqView const & seq2,
+								 AlignmentSetup & setup,
+								 AlignmentWorker & worker )
+{
+	assign( worker.seq1, seq1 );
+	assign( worker.seq2, seq2 );
+	align_read_pair( worker.seq1, worker.seq2, setup, worker );
+}
 
-		found_match_in_read2 = true;
-		record_counter( "found match in RNA sequence (read 2)", counter_idx, counter_counts, counter_tags );
-		if ( mscr == 0 ) record_counter( "found strict match in RNA sequence (read 2)", counter_idx, counter_counts, counter_tags );
+////////////////////////////////////////////////////////////////
+MatchContext::MatchContext( AlignmentSetup & setup ):
+	cseq_pattern( setup.cseq )
+{
+	//Set options for match, mismatch, gap. Again, should make these variables.
+	// penalize gaps to take into account length mismatches!
+	//    Pattern<String<char>, DPSearch<SimpleScore> > pattern_expt_id(ndl,SimpleScore(-1, -2, -1));
+	for ( unsigned n = 0; n < setup.short_expt_ids.size(); n++ ){
+		expt_id_patterns.push_back( TDPPattern( setup.short_expt_ids[ n ], SimpleScore( 0, -1, -1 ) ) );
+	}
 
-		float const weight = 1.0 / mpos_vector.size();
-		for (unsigned q = 0; q < mpos_vector.size(); q++ ){
-			int sid_idx = sid_vector[q];
-			int mpos    = mpos_vector[q];
-			if ( verbose ) std::cout << "READ2 " << mpos << " " << sid_idx << std::endl;
-			if ( mpos < 0 ) mpos = 0;
-			all_count[ expt_idx ][ sid_idx ][ mpos ] += weight;
-			//	if ( mscr == 0 ) all_count_strict[ expt_idx ][ sid_idx ][ mpos ] += weight;
-		}
+	// for short inserts, search for however much of adapter sequence 2 could fit into read 1.
+	adapter2_patterns.resize( length( setup.adapterSequence2 ) + 1 );
+	for ( unsigned n = 1; n < adapter2_patterns.size(); n++ ){
+		CharString adapter_sequence2_pattern = prefix( setup.adapterSequence2, n );
+		reverseComplement( adapter_sequence2_pattern );
+		adapter2_patterns[ n ] = TDPPattern( adapter_sequence2_pattern, SimpleScore( 0, -2, -2 ) );
 	}
 
+	setup_star_anchors( star_anchors, star_anchor_idx, setup.sequences_before_star );
+}
+
+////////////////////////////////////////////////////////////////
+AlignmentWorker::AlignmentWorker( Index<THaystacks> & index_sequence_id,
+																	Index<THaystacks> & index_expt_id,
+																	MatchContext const & match_context_,
+																	unsigned const seqCount_expt_id,
+																	unsigned const seqCount_library,
+																	unsigned const max_rna_len,
+																	CountType const count_type,
+																	CountStorage const count_storage,
+																	bool const profile_ ):
+	finder_sequence_id( index_sequence_id ),
+	finder_expt_id( index_expt_id ),
+	match_context( match_context_ )
+{
+	resize_purification_table( purification, seqCount_expt_id );
+	resize_counts( all_count, count_type, count_storage, seqCount_expt_id, seqCount_library, max_rna_len+1 );
+	resizeProfileStageTimes( profile, NUM_ALIGNMENT_STAGES, profile_ );
+	if ( length( match_context.star_anchors ) > 0 ) setHost( star_anchor_pattern, match_context.star_anchors );
+	scratch.star_anchor_end_pos.resize( length( match_context.star_anchors ) );
+}
+
+////////////////////////////////////////////////////////////////
+// add one thread's counts into the totals.
+void
+merge_counts( AlignmentWorker const & worker,
+							CountTensor & all_count,
+							PurificationTable & purification,
+							ProfileStageTimes & profile ){
+
+	merge_counts( all_count, worker.all_count );
+	merge_purification_tables( purification, worker.purification );
+	mergeProfileStageTimes( profile, worker.profile );
+}
+
+////////////////////////////////////////////////////////////////
+void
+resize_purification_table( PurificationTable & purification, unsigned const num_expt_ids ){
+	purification.num_expt_ids = num_expt_ids;
+	purification.counts.assign( NUM_PURIFICATION_COUNTERS * ( num_expt_ids + 1 ), 0 );
+}
+
+////////////////////////////////////////////////////////////////
+unsigned long
+get_counter( PurificationTable const & purification, PurificationCounter const counter, int const expt_idx ){
+	return purification.counts[ counter * ( purification.num_expt_ids + 1 ) + ( expt_idx + 1 ) ];
+}
 
-	std::cout << "Aligning " << counter_counts[0] << " sequences took " << SEQAN_PROTIMEDIFF(alignTime) << " seconds " << std::endl;
+////////////////////////////////////////////////////////////////
+unsigned long
+get_counter_total( PurificationTable const & purification, PurificationCounter const counter ){
+	unsigned long total( 0 );
+	for ( int n = -1; n < int( purification.num_expt_ids ); n++ ) total += get_counter( purification, counter, n );
+	return total;
+}
+
+////////////////////////////////////////////////////////////////
+void
+merge_purification_tables( PurificationTable & purification, PurificationTable const & other ){
+	for ( unsigned n = 0; n < purification.counts.size(); n++ ) purification.counts[ n ] += other.counts[ n ];
+}
+
+////////////////////////////////////////////////////////////////
+// the classic purification table, then the same filters for each experimental ID [primer or barcode].
+void
+output_purification_table( PurificationTable const & purification,
+													 std::vector< std::string > const & expt_id_names,
+													 bool const align_all,
+													 bool const read2_seed ){
 
 	std::cout << std::endl;
 	std::cout << "Purification table" << std::endl;
-	for ( unsigned i = 0; i < counter_counts.size(); i++ ){
-		std::cout << counter_counts[i] << " " << counter_tags[i] << std::endl;
+	// as ever, a stage shows up only once some read pair got to it [the per-expt-ID table below has them all].
+	for ( unsigned i = 0; i < num_purification_filters; i++ ){
+		PurificationCounter const counter = PurificationCounter( i );
+		unsigned long const total = get_counter_total( purification, counter );
+		if ( total == 0 ) break;
+		std::cout << total << " " << purification_counter_tags[ counter ] << std::endl;
 	}
 	std::cout << std::endl;
 
-	std::cout << "Perfect constant sequence: " << perfect << std::endl;
-	if ( align_all ) std::cout << "Null ligations           : " << nullLigation << std::endl;
+	std::cout << "Perfect constant sequence: " << get_counter_total( purification, PERFECT_COUNTER ) << std::endl;
+	if ( align_all ) std::cout << "Null ligations           : " << get_counter_total( purification, NULL_LIGATION_COUNTER ) << std::endl;
+	if ( read2_seed ){
+		unsigned long const num_searched = get_counter_total( purification, READ2_SEARCH_COUNTER );
+		unsigned long const num_seeded = get_counter_total( purification, READ2_SEED_COUNTER );
+		std::cout << "Read 2 placed by seed    : " << num_seeded << " of " << num_searched << " searched";
+		if ( num_searched > 0 ) std::cout << " [" << int( 1000.0 * num_seeded / num_searched + 0.5 ) / 10.0 << "%]";
+		std::cout << std::endl;
+	}
 
-	output_stats_files( all_count, outpath, "stats" );
-	//    output_stats_files( all_count_strict, outpath, "strict_stats" );
+	if ( purification.num_expt_ids == 0 ) return;
+	std::cout << std::endl;
+	std::cout << "Purification table by experimental ID [stats_ID*.txt]" << std::endl;
+	std::cout << "  ID    expt ID     read 1     read 2     strict";
+	if ( align_all ) std::cout << "  null lig.";
+	std::cout << "  name" << std::endl;
+	for ( unsigned n = 0; n < purification.num_expt_ids; n++ ){
+		std::cout << std::setw( 4 ) << n+1;
+		for ( unsigned i = EXPT_ID_COUNTER; i < num_purification_filters; i++ ) std::cout << " " << std::setw( 10 ) << get_counter( purification, PurificationCounter( i ), n );
+		if ( align_all ) std::cout << " " << std::setw( 10 ) << get_counter( purification, NULL_LIGATION_COUNTER, n );
+		if ( n < expt_id_names.size() ) std::cout << "  " << expt_id_names[ n ];
+		std::cout << std::endl;
+	}
+}
 
-	return 1;
+////////////////////////////////////////////////////////////////
+// --profile: per-stage calls, hits [read pairs that got through], and latencies, summed over threads.
+// Printed after the purification table, and written to profile.json in the output path.
+void
+output_profile_report( ProfileStageTimes const & profile,
+											 unsigned const num_threads,
+											 double const align_time,
+											 std::string const & outpath ){
+
+	std::ostringstream report;
+	report << "{" << std::endl;
+	report << "  \"threads\": " << num_threads << "," << std::endl;
+	report << "  \"align_seconds\": " << align_time << "," << std::endl;
+	report << "  \"stages\": ";
+	writeProfileStageTimesJson( report, profile, alignment_stage_names, "  " );
+	report << std::endl << "}" << std::endl;
+
+	std::cout << std::endl << "Profile" << std::endl << report.str();
+
+	std::string const profile_outFileName = outpath + "profile.json";
+	std::ofstream profile_out( profile_outFileName.c_str() );
+	if ( !profile_out ) { std::cerr << "Problem writing: " << profile_outFileName << std::endl; return; }
+	profile_out << report.str();
 }
 
 ///////////////////////////////////////////////
@@ -480,23 +1108,6 @@ findchar( String<char> & seq, char c ){
 	return -1;
 }
 
-/////////////////////////////////////
-void record_counter( std::string const tag,
-										 unsigned & counter_idx,
-										 std::vector< unsigned > & counter_counts,
-										 std::vector< std::string > & counter_tags ){
-
-  if (counter_idx >= counter_tags.size() ) {
-    counter_tags.push_back( tag );
-    counter_counts.push_back( 0 );
-  }
-  counter_counts[ counter_idx ]++;
-  counter_idx++;
-  //  std::cout << "counter_idx: " << counter_idx << std::endl;
-}
-
-
-
 /////////////////////////////////////////////////////////////////////////////
 int
 try_exact_match( CharString & seq1, CharString & cseq, unsigned & perfect ){
@@ -528,14 +1139,13 @@ try_exact_match( CharString & seq1, CharString & cseq ){
 
 /////////////////////////////////////////////////////////////////////////////
 int
-try_DP_match( CharString & seq1, CharString & cseq, unsigned & perfect ){
+try_DP_match( CharString & seq1, TCseqPattern & pattern_constant_sequence_DP, unsigned & perfect ){
 
   int pos1( -1 );
 
   Finder<String<char> > finder_constant_sequence(seq1); // this is what to search.
-  //Set options for gap, mismatch,deletion
+  // pattern was set up in MatchContext; same hits and scores as DPSearch with SimpleScore( 0, -2, -1 ) [gap -1, mismatch -2].
   int score_cutoff( -2 ), best_score( score_cutoff-1 );
-  Pattern<String<char>, DPSearch<SimpleScore> > pattern_constant_sequence_DP(cseq,SimpleScore(0, -2, -1));
 
   // Find best match in case there are several.
   while( find(finder_constant_sequence, pattern_constant_sequence_DP, score_cutoff)) {
@@ -559,21 +1169,17 @@ try_DP_match( CharString & seq1, CharString & cseq, unsigned & perfect ){
 
 ///////////////////////////////////////////////////////////////////////////////
 int
-try_DP_match_expt_ids( std::vector< CharString > & short_expt_ids, CharString & expt_id_in_read1 ){
+try_DP_match_expt_ids( std::vector< TDPPattern > & expt_id_patterns, CharString & expt_id_in_read1 ){
 
   // use DP to allow mismatches
   int score_cutoff( -2 ), best_score( score_cutoff - 1 ), expt_idx( -1 );
 
-  for ( unsigned n = 0; n < short_expt_ids.size(); n++ ){
+  for ( unsigned n = 0; n < expt_id_patterns.size(); n++ ){
 
     Finder<String<char> > finder_one_expt_id( expt_id_in_read1 );
 
-    // could we save some time by preconstructing patterns?
-    String<char> & ndl = short_expt_ids[n]; // this is the needle. const doesn't seem to work.
-    //Set options for match, mismatch, gap. Again, should make these variables.
-    // penalize gaps to take into account length mismatches!
-    //    Pattern<String<char>, DPSearch<SimpleScore> > pattern_expt_id(ndl,SimpleScore(-1, -2, -1));
-    Pattern<String<char>, DPSearch<SimpleScore> > pattern_expt_id(ndl,SimpleScore(0, -1, -1));
+    // patterns are preconstructed in MatchContext.
+    TDPPattern & pattern_expt_id = expt_id_patterns[ n ];
 
     best_score = score_cutoff - 1;
 
@@ -597,6 +1203,205 @@ try_DP_match_expt_ids( std::vector< CharString > & short_expt_ids, CharString &
 }
 
 
+////////////////////////////////////////////////////
+// Precompute answers of the exact index search and of try_DP_match_expt_ids() for any piece of read 1
+// that could give a hit. See ExptIdClassifier.
+void
+setup_expt_id_classifier( ExptIdClassifier & classifier,
+													std::vector< CharString > const & short_expt_ids,
+													Index<THaystacks> & index_expt_id ){
+
+	// score cutoff in try_DP_match_expt_ids() is -2, with -1 per mismatch or gap.
+	static unsigned const max_edits( 2 );
+	// packing uses 3 bits per nucleotide, and expt IDs can grow by max_edits insertions.
+	static unsigned const max_packed_length( 21 );
+
+	classifier.enabled = false;
+	classifier.max_expt_id_length = 0;
+	for ( unsigned n = 0; n < short_expt_ids.size(); n++ ){
+		CharString const & expt_id = short_expt_ids[n];
+		if ( length( expt_id ) <= max_edits || length( expt_id ) + max_edits > max_packed_length ) return;
+		for ( unsigned i = 0; i < length( expt_id ); i++ ) if ( pack_nucleotide( expt_id[i] ) > 5 ) return;
+		if ( length( expt_id ) > classifier.max_expt_id_length ) classifier.max_expt_id_length = length( expt_id );
+	}
+	if ( short_expt_ids.size() == 0 ) return;
+
+	// exact matches: ask the index what it would return for each substring of each expt ID.
+	Finder<Index<THaystacks> > finder_expt_id( index_expt_id );
+	for ( unsigned n = 0; n < short_expt_ids.size(); n++ ){
+		std::string expt_id( toCString( short_expt_ids[n] ) );
+		for ( unsigned i = 0; i <= expt_id.size(); i++ ){
+			for ( unsigned len = 0; i + len <= expt_id.size(); len++ ){
+				CharString piece = expt_id.substr( i, len );
+				int & expt_idx = hash_value( classifier.exact_matches, pack_sequence( toCString( piece ) ) );
+				if ( expt_idx >= 0 ) continue; // already done
+				clear( finder_expt_id );
+				if ( find( finder_expt_id, piece ) ) expt_idx = beginPosition( finder_expt_id ).i1;
+			}
+		}
+	}
+	clear( finder_expt_id );
+
+	// matches with edits: try_DP_match_expt_ids() ends up with the last expt ID that has any hit within the cutoff.
+	classifier.is_query_length.assign( classifier.max_expt_id_length + max_edits + 1, false );
+	for ( unsigned n = 0; n < short_expt_ids.size(); n++ ){
+		add_edit_neighbors( classifier.edit_matches, toCString( short_expt_ids[n] ), n, max_edits );
+		for ( unsigned len = length( short_expt_ids[n] ) - max_edits; len <= length( short_expt_ids[n] ) + max_edits; len++ ) classifier.is_query_length[ len ] = true;
+	}
+
+	classifier.enabled = true;
+}
+
+////////////////////////////////////////////////////
+// Record expt_idx for every sequence within num_edits substitutions, insertions, or deletions of seq.
+// Besides A,C,G,T,N, we only need one more character to stand for anything else in a read, since
+// it would mismatch all of them.
+void
+add_edit_neighbors( PackedSequenceHash & edit_matches, std::string const & seq, int const expt_idx, unsigned const num_edits ){
+
+	int & value = hash_value( edit_matches, pack_sequence( seq ) );
+	if ( value < expt_idx ) value = expt_idx;
+	if ( num_edits == 0 ) return;
+
+	static std::string const nucleotides( "ACGTN#" );
+	for ( unsigned i = 0; i <= seq.size(); i++ ){
+		for ( unsigned k = 0; k < nucleotides.size(); k++ ){
+			std::string insertion( seq );
+			insertion.insert( i, 1, nucleotides[k] );
+			add_edit_neighbors( edit_matches, insertion, expt_idx, num_edits - 1 );
+
+			if ( i == seq.size() || nucleotides[k] == seq[i] ) continue;
+			std::string substitution( seq );
+			substitution[i] = nucleotides[k];
+			add_edit_neighbors( edit_matches, substitution, expt_idx, num_edits - 1 );
+		}
+		if ( i == seq.size() ) continue;
+		std::string deletion( seq );
+		deletion.erase( i, 1 );
+		add_edit_neighbors( edit_matches, deletion, expt_idx, num_edits - 1 );
+	}
+}
+
+////////////////////////////////////////////////////
+// Same answer as the exact index search followed by try_DP_match_expt_ids(), using the tables in the classifier.
+int
+classify_expt_id( ExptIdClassifier const & classifier, CharString const & expt_id_in_read1 ){
+
+	unsigned const read_length = length( expt_id_in_read1 );
+
+	// exact match -- read 1 needs to be a piece of an expt ID.
+	if ( read_length <= classifier.max_expt_id_length ){
+		__uint64 key( 0 );
+		for ( unsigned i = 0; i < read_length; i++ ) key = ( key << 3 ) | pack_nucleotide( expt_id_in_read1[i] );
+		int const expt_idx = find_hash_value( classifier.exact_matches, key );
+		if ( expt_idx >= 0 ) return expt_idx;
+	}
+
+	// up to 2 edits -- look up each piece of read 1 that is about as long as an expt ID.
+	int expt_idx( -1 );
+	unsigned const max_query_length = classifier.is_query_length.size() - 1;
+	for ( unsigned i = 0; i < read_length; i++ ){
+		__uint64 key( 0 );
+		for ( unsigned len = 1; len <= max_query_length && i + len <= read_length; len++ ){
+			key = ( key << 3 ) | pack_nucleotide( expt_id_in_read1[ i + len - 1 ] );
+			if ( !classifier.is_query_length[ len ] ) continue;
+			int const n = find_hash_value( classifier.edit_matches, key );
+			if ( n > expt_idx ) expt_idx = n;
+		}
+	}
+	return expt_idx;
+}
+
+////////////////////////////////////////////////////
+// 3 bits per nucleotide; codes start at 1, so that sequences of different lengths get different keys.
+__uint64
+pack_sequence( std::string const & seq ){
+	__uint64 key( 0 );
+	for ( unsigned i = 0; i < seq.size(); i++ ) key = ( key << 3 ) | pack_nucleotide( seq[i] );
+	return key;
+}
+
+////////////////////////////////////////////////////
+unsigned
+pack_nucleotide( char const c ){
+	switch ( c ){
+	case 'A': return 1;
+	case 'C': return 2;
+	case 'G': return 3;
+	case 'T': return 4;
+	case 'N': return 5;
+	}
+	return 6;
+}
+
+////////////////////////////////////////////////////
+// marks empty slots -- packed sequences never set the top bit.
+__uint64 const empty_hash_key( ~__uint64( 0 ) );
+
+PackedSequenceHash::PackedSequenceHash():
+	keys( 1024, empty_hash_key ),
+	values( 1024, -1 ),
+	num_entries( 0 )
+{}
+
+////////////////////////////////////////////////////
+inline
+unsigned
+hash_slot( __uint64 const key, unsigned const table_size ){
+	return unsigned( ( key * 0x9E3779B97F4A7C15ULL ) >> 32 ) & ( table_size - 1 );
+}
+
+////////////////////////////////////////////////////
+// value stored for key, added as -1 if not yet in the table.
+int &
+hash_value( PackedSequenceHash & hash, __uint64 const key ){
+	if ( 2 * ( hash.num_entries + 1 ) > hash.keys.size() ) rehash( hash, 2 * hash.keys.size() );
+	unsigned slot = hash_slot( key, hash.keys.size() );
+	while ( hash.keys[ slot ] != key ){
+		if ( hash.keys[ slot ] == empty_hash_key ){
+			hash.keys[ slot ] = key;
+			hash.num_entries++;
+			break;
+		}
+		slot = ( slot + 1 ) & ( hash.keys.size() - 1 );
+	}
+	return hash.values[ slot ];
+}
+
+////////////////////////////////////////////////////
+// -1 if key is not in the table.
+int
+find_hash_value( PackedSequenceHash const & hash, __uint64 const key ){
+	unsigned slot = hash_slot( key, hash.keys.size() );
+	while ( hash.keys[ slot ] != empty_hash_key ){
+		if ( hash.keys[ slot ] == key ) return hash.values[ slot ];
+		slot = ( slot + 1 ) & ( hash.keys.size() - 1 );
+	}
+	return -1;
+}
+
+////////////////////////////////////////////////////
+void
+rehash( PackedSequenceHash & hash, unsigned const new_size ){
+	std::vector< __uint64 > old_keys( new_size, empty_hash_key );
+	std::vector< int > old_values( new_size, -1 );
+	old_keys.swap( hash.keys );
+	old_values.swap( hash.values );
+	for ( unsigned i = 0; i < old_keys.size(); i++ ){
+		if ( old_keys[ i ] == empty_hash_key ) continue;
+		unsigned slot = hash_slot( old_keys[ i ], hash.keys.size() );
+		while ( hash.keys[ slot ] != empty_hash_key ) slot = ( slot + 1 ) & ( hash.keys.size() - 1 );
+		hash.keys[ slot ] = old_keys[ i ];
+		hash.values[ slot ] = old_values[ i ];
+	}
+}
+
+////////////////////////////////////////////////////
+ExptIdClassifier::ExptIdClassifier():
+	enabled( false ),
+	max_expt_id_length( 0 )
+{}
+
 ////////////////////////////////////////////////////
 bool
 get_next_variant( CharString const & seq, CharString & seq_var, unsigned & variant_counter, unsigned const & seqid_length ){
@@ -668,6 +1473,7 @@ void
 figure_out_expt_IDs( std::string const & file_primers,
 										 std::string const & file_expt_id,
 										 std::vector< String<char> > & short_expt_ids,
+										 std::vector< std::string > & expt_id_names,
 										 THaystacks & haystacks_expt_ids,
 										 CharString & cseq,
 										 CharString & adapterSequence ){
@@ -687,9 +1493,12 @@ figure_out_expt_IDs( std::string const & file_primers,
 		std::cout << "Number of primers: " << seqCount_primers << std::endl;
 
 		String<char > seq_primer;
+		std::string primer_name;
 		std::vector< String<char> > seq_primers, seq_primers_RC;
 		for(unsigned j=0; j< seqCount_primers; j++) {
 			assignSeq(seq_primer, multiSeqFile_primers[j], format_primers);    // read sequence
+			assignSeqId(primer_name, multiSeqFile_primers[j], format_primers);    // read sequence id
+			expt_id_names.push_back( primer_name );
 			seq_primers.push_back( seq_primer );
 
 			CharString seq_primer_RC( seq_primer );
@@ -763,9 +1572,11 @@ figure_out_expt_IDs( std::string const & file_primers,
 		///////////////////////////////////////////////////
 		// create a haystack to search with barcodes.
 		///////////////////////////////////////////////////
+		std::string expt_id_name;
 		for(unsigned j=0; j< seqCount_expt_id; j++) {
-			//	assignSeqId(seq_expt_id_ID, multiSeqFile_expt_id[j], format_expt_id);    // read sequence
+			assignSeqId(expt_id_name, multiSeqFile_expt_id[j], format_expt_id);    // read sequence id
 			assignSeq(seq_expt_id, multiSeqFile_expt_id[j], format_expt_id);    // read sequence
+			expt_id_names.push_back( expt_id_name );
 
 			short_expt_ids.push_back( seq_expt_id );
 			appendValue(haystacks_expt_ids, seq_expt_id );
@@ -810,25 +1621,35 @@ check_unique_id(  std::vector< String<char> > const & rna_library_vector_RC,
 	//throw a warning if an incorrect value is believed to have been specified.
 	//An accurate RNA library sequence ID length should be the shortest sequence from the 3' end that is
 	//sufficient to distinguish any sequence in the library from any other.
-	unsigned inferred_id_length = 0;
-	bool match_found = true;
+	//
+	//Two library members look the same out to the length of their longest common prefix [of the reverse
+	//complements], so the ID length needed is set by the longest common prefix over all pairs -- and after
+	//sorting, that is always between neighbors. Identical library members can never be told apart.
+	unsigned const seqCount_library = rna_library_vector_RC.size();
+	std::vector< unsigned > sorted_idx( seqCount_library );
+	for ( unsigned j = 0; j < seqCount_library; j++ ) sorted_idx[ j ] = j;
+	std::sort( sorted_idx.begin(), sorted_idx.end(), LibrarySequenceLess( rna_library_vector_RC ) );
+
+	unsigned max_common_prefix( 0 );
+	bool identical_found( false );
+	for ( unsigned j = 1; j < seqCount_library; j++ ){
+		String<char> const & seq1 = rna_library_vector_RC[ sorted_idx[ j-1 ] ];
+		String<char> const & seq2 = rna_library_vector_RC[ sorted_idx[ j ] ];
+		unsigned const min_len = std::min( length( seq1 ), length( seq2 ) );
+		unsigned common_prefix = 0;
+		while ( common_prefix < min_len && seq1[ common_prefix ] == seq2[ common_prefix ] ) common_prefix++;
+		if ( common_prefix == length( seq1 ) && common_prefix == length( seq2 ) ) identical_found = true;
+		if ( common_prefix > max_common_prefix ) max_common_prefix = common_prefix;
+	}
+
+	//Shortest i >= 1 for which no two members share their first i+cseq_len nts, but no more than the longest
+	//possible ID (max_rna_len - cseq_len - 1).
 	unsigned cseq_len = length( cseq );
-	for(unsigned i = 1; i < max_rna_len - cseq_len; i++){
-		if(!match_found) break;
-		inferred_id_length = i;
-		match_found = false;
-		unsigned const seqCount_library = rna_library_vector_RC.size();
-		for(unsigned j = 0; j < seqCount_library; j++){
-			String<char> test_seq = prefix( rna_library_vector_RC[j], i+cseq_len );
-			for(unsigned k = j+1; k < seqCount_library; k++){
-				String<char> comp_seq = prefix( rna_library_vector_RC[k], i+cseq_len );
-				if(test_seq == comp_seq){
-					match_found = true;
-					break;
-				}
-			}
-			if(match_found) break;
-		}
+	unsigned const max_id_length = max_rna_len - cseq_len - 1;
+	unsigned inferred_id_length = 0;
+	if ( max_rna_len - cseq_len > 1 ) {
+		inferred_id_length = ( max_common_prefix + 1 > cseq_len + 1 ) ? max_common_prefix + 1 - cseq_len : 1;
+		if ( identical_found || inferred_id_length > max_id_length ) inferred_id_length = max_id_length;
 	}
 	std::cerr << "Inferred sequence ID length needed to ensure disambiguation: " << inferred_id_length << std::endl;
 
@@ -856,73 +1677,78 @@ disambiguate_possible_sids( std::vector< unsigned > & possible_sids,
 														unsigned const min_pos,
 														CharString const & seq1,
 														std::vector< CharString > const & RNA_sequences ) {
-  int max_match = 0;
-  CharString seq_from_library;
-  std::vector< unsigned > possible_sids_new;
-  for ( int s = 0; s < possible_sids.size(); s++ ) {
-    seq_from_library = RNA_sequences[ possible_sids[s] ];
-    int n_seq1    = min_pos           ; // + seqid_length;
-    int n_library = possible_begpos[s]; // + seqid_length;
-    unsigned num_match( 0 );
-    while ( n_seq1 >= 0 && n_library >= 0 &&
-						( seq1[ n_seq1 ] == seq_from_library[ n_library ] ) ){
-      n_seq1--; n_library--; num_match++;
-    }
-    if ( num_match > max_match )  {
-      possible_sids_new.clear();
-      max_match = num_match;
-    }
-    if ( num_match == max_match ) possible_sids_new.push_back( possible_sids[s] );
+  // keep the sids with the most matches, in place -- first find out how many that is.
+  unsigned max_match = 0;
+  for ( unsigned s = 0; s < possible_sids.size(); s++ ) {
+    unsigned const num_match = get_number_of_matches_before_sequence_id( seq1, min_pos, RNA_sequences[ possible_sids[s] ], possible_begpos[s] );
+    if ( num_match > max_match ) max_match = num_match;
+  }
+  unsigned num_kept( 0 );
+  for ( unsigned s = 0; s < possible_sids.size(); s++ ) {
+    unsigned const num_match = get_number_of_matches_before_sequence_id( seq1, min_pos, RNA_sequences[ possible_sids[s] ], possible_begpos[s] );
+    if ( num_match == max_match ) possible_sids[ num_kept++ ] = possible_sids[s];
   }
-  possible_sids = possible_sids_new;
+  possible_sids.resize( num_kept );
+}
+
+/////////////////////////////////////////////////////
+// how many nts match going backwards from the start of the sequence ID window in read 1, and from where it hit in the library sequence.
+unsigned
+get_number_of_matches_before_sequence_id( CharString const & seq1,
+																					unsigned const min_pos,
+																					CharString const & seq_from_library,
+																					unsigned const begpos ) {
+  int n_seq1    = min_pos; // + seqid_length;
+  int n_library = begpos;  // + seqid_length;
+  unsigned num_match( 0 );
+  while ( n_seq1 >= 0 && n_library >= 0 &&
+					( seq1[ n_seq1 ] == seq_from_library[ n_library ] ) ){
+    n_seq1--; n_library--; num_match++;
+  }
+  return num_match;
 }
 
 
 /////////////////////////////////////////////////////
 // should only be called with --align_all or -A option.
 void
-check_for_short_insert( CharString const & adapterSequence2,
+check_for_short_insert( std::vector< TDPPattern > & adapter2_patterns,
 												CharString const & cseq,
 												unsigned const & constant_sequence_begin_pos,
 												unsigned const & seqid_length,
 												CharString & seq1,
 												Finder<Index<THaystacks> > & finder_sequence_id,
 												std::vector< unsigned > & possible_sids,
+												CharString & sequence_id_in_read1,
 												bool const & align_null,
 												bool & verbose,
 												unsigned & nullLigation ){
 
-  CharString adapter_sequence2_pattern = adapterSequence2;
   int length_of_adapter_sequence2( constant_sequence_begin_pos - seqid_length - 1 );
   static int const min_length_of_adapter_sequence2( 7 );
   if ( length_of_adapter_sequence2 < min_length_of_adapter_sequence2 ) length_of_adapter_sequence2 = min_length_of_adapter_sequence2;
-  if ( length_of_adapter_sequence2 < length( adapterSequence2 ) ){
-    adapter_sequence2_pattern = infixWithLength( adapterSequence2, 0, length_of_adapter_sequence2 );
-  }
-  reverseComplement( adapter_sequence2_pattern );
-  Pattern<String<char>, DPSearch<SimpleScore> > pattern_constant_sequence_DP( adapter_sequence2_pattern, SimpleScore(0, -2, -2));
+  if ( length_of_adapter_sequence2 > int( adapter2_patterns.size() ) - 1 ) length_of_adapter_sequence2 = adapter2_patterns.size() - 1;
+  TDPPattern & pattern_constant_sequence_DP = adapter2_patterns[ length_of_adapter_sequence2 ];
   Finder<String<char> > finder_in_seq1(seq1);
   int adapter_sequence2_pos( 0 );
-  CharString fragment;
 
   if ( find( finder_in_seq1, pattern_constant_sequence_DP, -1 /*score cutoff*/ ) ){
     adapter_sequence2_pos = beginPosition( finder_in_seq1 );
     if ( constant_sequence_begin_pos >= adapter_sequence2_pos - 1  ){
       if ( align_null || constant_sequence_begin_pos >= adapter_sequence2_pos )  {
-				fragment = infixWithLength( seq1, adapter_sequence2_pos, constant_sequence_begin_pos - adapter_sequence2_pos + 1);
-				CharString sequence_id_in_read1 = fragment;
+				unsigned const fragment_length = constant_sequence_begin_pos - adapter_sequence2_pos + 1;
+				sequence_id_in_read1 = infixWithLength( seq1, adapter_sequence2_pos, fragment_length );
 				append( sequence_id_in_read1, cseq );
-				std::vector< unsigned > mpos_vector, sid_vector;
-				Pattern<CharString> pattern_sequence_id_in_read1( sequence_id_in_read1 ); // this is now the 'needle' -- look for this sequence in the haystack of potential sequence IDs
+				// this is now the 'needle' -- look for this sequence in the haystack of potential sequence IDs
 				clear( finder_sequence_id );
-				while( find(finder_sequence_id, pattern_sequence_id_in_read1)) { // let's try *all* possibilities
+				while( find(finder_sequence_id, sequence_id_in_read1)) { // let's try *all* possibilities
 					int sid = beginPosition(finder_sequence_id).i1;
 					possible_sids.push_back( sid );
 					// note that this is a totally valid guess for mpos -- but we'll still check read2
 					int mpos = beginPosition(finder_sequence_id).i2;
 					//if (!verbose) std::cout << seq1 << " " << seq2 << std::endl;
 					//	  if ( sid == 180 && length( fragment ) >= 10 ) verbose = true;
-					if ( verbose ) std::cout << "READ1 " << mpos << " " << sid << " " << seq1 << " " << length( fragment ) << " " << fragment << std::endl;
+					if ( verbose ) std::cout << "READ1 " << mpos << " " << sid << " " << seq1 << " " << fragment_length << " " << infixWithLength( seq1, adapter_sequence2_pos, fragment_length ) << std::endl;
 				}
       }
     }
@@ -931,6 +1757,49 @@ check_for_short_insert( CharString const & adapterSequence2,
 }
 
 
+////////////////////////////////////
+// --read2_window: how long the RNA fragment can be, going by read 1. If read 1 runs into adapter 2 [looked for
+// as in check_for_short_insert(), or just its first nts, right at the start of read 1], the fragment is what lies
+// between it and the primer binding site. Otherwise, the fragment is at least as long as the part of it read 1 saw,
+// less the few nts of adapter 2 too short to tell apart from RNA. max_fragment_length is -1 if unknown.
+void
+get_fragment_length_in_read1( std::vector< TDPPattern > & adapter2_patterns,
+															CharString & seq1,
+															int const constant_sequence_begin_pos,
+															unsigned const seqid_length,
+															int & min_fragment_length,
+															int & max_fragment_length ){
+	min_fragment_length = 0;
+	max_fragment_length = -1;
+	if ( constant_sequence_begin_pos < 0 ) return;
+
+	int length_of_adapter_sequence2( constant_sequence_begin_pos - seqid_length - 1 );
+	static int const min_length_of_adapter_sequence2( 7 );
+	if ( length_of_adapter_sequence2 < min_length_of_adapter_sequence2 ) length_of_adapter_sequence2 = min_length_of_adapter_sequence2;
+	if ( length_of_adapter_sequence2 > int( adapter2_patterns.size() ) - 1 ) length_of_adapter_sequence2 = adapter2_patterns.size() - 1;
+	if ( length_of_adapter_sequence2 < 1 ) return; // no adapter 2 to look for, so no telling.
+
+	Finder<String<char> > finder_in_seq1( seq1 );
+	int adapter_sequence2_pos( -1 );
+	if ( find( finder_in_seq1, adapter2_patterns[ length_of_adapter_sequence2 ], -1 /*score cutoff*/ ) ){
+		adapter_sequence2_pos = beginPosition( finder_in_seq1 );
+	} else {
+		// read 1 may begin partway into adapter 2: then it begins with the [reverse complement of the] first nts of it.
+		int n = std::min( constant_sequence_begin_pos + 1, int( adapter2_patterns.size() ) - 1 );
+		for ( ; n >= min_length_of_adapter_sequence2 && adapter_sequence2_pos < 0; n-- ){
+			CharString const & adapter_sequence2_pattern = needle( adapter2_patterns[ n ] );
+			int i( 0 );
+			while ( i < n && seq1[ i ] == adapter_sequence2_pattern[ i ] ) i++;
+			if ( i == n ) adapter_sequence2_pos = n;
+		}
+	}
+	if ( adapter_sequence2_pos >= 0 && constant_sequence_begin_pos >= adapter_sequence2_pos - 1 ){
+		min_fragment_length = max_fragment_length = constant_sequence_begin_pos - adapter_sequence2_pos + 1;
+		return;
+	}
+	min_fragment_length = std::max( 0, constant_sequence_begin_pos + 1 - ( min_length_of_adapter_sequence2 - 1 ) );
+}
+
 ////////////////////////////////////
 void
 find_possible_sids( std::vector< unsigned > & possible_sids,
@@ -938,104 +1807,658 @@ find_possible_sids( std::vector< unsigned > & possible_sids,
 										Finder<Index<THaystacks> > & finder_sequence_id,
 										CharString & sequence_id_region_in_sequence1 ){
 
-  Pattern<CharString> pattern_sequence_id_in_read1(sequence_id_region_in_sequence1); // this is now the 'needle' -- look for this sequence in the haystack of potential sequence IDs
+  // sequence_id_region_in_sequence1 is now the 'needle' -- look for this sequence in the haystack of potential sequence IDs
   clear( finder_sequence_id ); //reset.
-  while( find(finder_sequence_id, pattern_sequence_id_in_read1)) {
+  while( find(finder_sequence_id, sequence_id_region_in_sequence1)) {
     // seq_from_library contains the RNA library sequences
     possible_sids.push_back( beginPosition(finder_sequence_id).i1 );
     possible_begpos.push_back( beginPosition(finder_sequence_id).i2 ); // useful for disambiguation.
   }
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Same hits as the index search above, looked up in the table set up by setup_sequence_id_table().
+void
+find_possible_sids( std::vector< unsigned > & possible_sids,
+										std::vector< unsigned > & possible_begpos,
+										SequenceIdTable const & sequence_id_table,
+										CharString const & sequence_id_region_in_sequence1 ){
+
+	__uint64 key( 0 );
+	if ( !pack_sequence_id_window( sequence_id_region_in_sequence1, sequence_id_table.seqid_length, key ) ) return;
+	int const k = find_hash_value( sequence_id_table.windows, key );
+	if ( k < 0 ) return;
+	possible_sids.insert( possible_sids.end(), sequence_id_table.sids[ k ].begin(), sequence_id_table.sids[ k ].end() );
+	possible_begpos.insert( possible_begpos.end(), sequence_id_table.begpos[ k ].begin(), sequence_id_table.begpos[ k ].end() );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Same hits as running the index search on each variant from get_next_variant(), in the same order.
+void
+find_possible_sids_in_variants( std::vector< unsigned > & possible_sids,
+																std::vector< unsigned > & possible_begpos,
+																SequenceIdTable const & sequence_id_table,
+																CharString const & sequence_id_region_in_sequence1 ){
+
+	unsigned const seqid_length = sequence_id_table.seqid_length;
+	if ( length( sequence_id_region_in_sequence1 ) < seqid_length ) return;
+
+	// a window with one N (or other non-ACGT character) can only hit when that position is varied.
+	int non_ACGT_pos( -1 );
+	for ( unsigned i = 0; i < seqid_length; i++ ){
+		if ( pack_nucleotide( sequence_id_region_in_sequence1[i] ) <= 4 ) continue;
+		if ( non_ACGT_pos >= 0 ) return; // two or more -- no single-nt variant can hit.
+		non_ACGT_pos = i;
+	}
+
+	if ( non_ACGT_pos >= 0 ){
+		static std::string const DNAchars ("ACGT");
+		CharString sequence_id_region_variant = prefix( sequence_id_region_in_sequence1, seqid_length );
+		for ( unsigned n = 0; n < DNAchars.size(); n++ ){
+			sequence_id_region_variant[ non_ACGT_pos ] = DNAchars[n];
+			find_possible_sids( possible_sids, possible_begpos, sequence_id_table, sequence_id_region_variant );
+		}
+		return;
+	}
+
+	__uint64 key( 0 );
+	pack_sequence_id_window( sequence_id_region_in_sequence1, seqid_length, key );
+	int const k = find_hash_value( sequence_id_table.variant_windows, key );
+	if ( k < 0 ) return;
+	possible_sids.insert( possible_sids.end(), sequence_id_table.variant_sids[ k ].begin(), sequence_id_table.variant_sids[ k ].end() );
+	possible_begpos.insert( possible_begpos.end(), sequence_id_table.variant_begpos[ k ].begin(), sequence_id_table.variant_begpos[ k ].end() );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// See SequenceIdTable.
+void
+setup_sequence_id_table( SequenceIdTable & sequence_id_table,
+												 std::vector< CharString > const & RNA_sequences,
+												 CharString const & cseq,
+												 unsigned const seqid_length,
+												 Index<THaystacks> & index_sequence_id,
+												 bool const match_single_nt_variants ){
+
+	// 2 bits per nt, and all T's would be the empty key of the hash.
+	static unsigned const max_packed_length( 31 );
+
+	sequence_id_table.enabled = false;
+	sequence_id_table.seqid_length = seqid_length;
+	if ( seqid_length == 0 || seqid_length > max_packed_length || length( cseq ) == 0 ) return;
+
+	// windows of seqid_length nts that are followed by cseq in some RNA.
+	std::vector< CharString > windows;
+	std::string const cseq_string( toCString( cseq ) );
+	for ( unsigned j = 0; j < RNA_sequences.size(); j++ ){
+		std::string const RNA_sequence( toCString( RNA_sequences[ j ] ) );
+		for ( size_t p = RNA_sequence.find( cseq_string ); p != std::string::npos; p = RNA_sequence.find( cseq_string, p + 1 ) ){
+			if ( p < seqid_length ) continue;
+			CharString window = RNA_sequence.substr( p - seqid_length, seqid_length ).c_str();
+			__uint64 key( 0 );
+			if ( !pack_sequence_id_window( window, seqid_length, key ) ) return; // can't pack -- use index instead.
+			int & k = hash_value( sequence_id_table.windows, key );
+			if ( k >= 0 ) continue;
+			k = windows.size();
+			windows.push_back( window );
+		}
+	}
+
+	// ask the index for the hits of each window, just like find_possible_sids().
+	Finder<Index<THaystacks> > finder_sequence_id( index_sequence_id );
+	sequence_id_table.sids.resize( windows.size() );
+	sequence_id_table.begpos.resize( windows.size() );
+	for ( unsigned k = 0; k < windows.size(); k++ ){
+		CharString sequence_id_region = windows[ k ];
+		append( sequence_id_region, cseq );
+		find_possible_sids( sequence_id_table.sids[ k ], sequence_id_table.begpos[ k ], finder_sequence_id, sequence_id_region );
+	}
+
+	if ( match_single_nt_variants ){
+		// a read window w hits window v's sids if v is w with the nt at some position i changed to v[i]. get_next_variant()
+		// goes through positions i in order, then through ACGT, so collect hits in that order.
+		static std::string const DNAchars ("ACGT");
+		std::vector< std::vector< std::pair< unsigned, unsigned > > > variant_hits; // ( i * 4 + n, k ) for each variant.
+		for ( unsigned k = 0; k < windows.size(); k++ ){
+			CharString variant = windows[ k ];
+			for ( unsigned i = 0; i < seqid_length; i++ ){
+				char const nt = windows[ k ][ i ];
+				for ( unsigned n = 0; n < DNAchars.size(); n++ ){
+					if ( DNAchars[n] == nt ) continue;
+					variant[ i ] = DNAchars[n];
+					__uint64 key( 0 );
+					pack_sequence_id_window( variant, seqid_length, key );
+					int & v = hash_value( sequence_id_table.variant_windows, key );
+					if ( v < 0 ) {
+						v = variant_hits.size();
+						variant_hits.push_back( std::vector< std::pair< unsigned, unsigned > >() );
+					}
+					variant_hits[ v ].push_back( std::make_pair( i * 4 + DNAchars.find( nt ), k ) );
+				}
+				variant[ i ] = nt;
+			}
+		}
+
+		sequence_id_table.variant_sids.resize( variant_hits.size() );
+		sequence_id_table.variant_begpos.resize( variant_hits.size() );
+		for ( unsigned v = 0; v < variant_hits.size(); v++ ){
+			std::sort( variant_hits[ v ].begin(), variant_hits[ v ].end() );
+			for ( unsigned m = 0; m < variant_hits[ v ].size(); m++ ){
+				unsigned const k = variant_hits[ v ][ m ].second;
+				sequence_id_table.variant_sids[ v ].insert( sequence_id_table.variant_sids[ v ].end(), sequence_id_table.sids[ k ].begin(), sequence_id_table.sids[ k ].end() );
+				sequence_id_table.variant_begpos[ v ].insert( sequence_id_table.variant_begpos[ v ].end(), sequence_id_table.begpos[ k ].begin(), sequence_id_table.begpos[ k ].end() );
+			}
+		}
+	}
+
+	sequence_id_table.enabled = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// 2 bits per nt of the first seqid_length nts of seq. Returns false if they are not all A,C,G,T.
+bool
+pack_sequence_id_window( CharString const & seq, unsigned const seqid_length, __uint64 & key ){
+	if ( length( seq ) < seqid_length ) return false;
+	key = 0;
+	for ( unsigned i = 0; i < seqid_length; i++ ){
+		unsigned const code = pack_nucleotide( seq[i] );
+		if ( code > 4 ) return false;
+		key = ( key << 2 ) | ( code - 1 );
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+SequenceIdTable::SequenceIdTable():
+	enabled( false ),
+	seqid_length( 0 )
+{}
+
+//////////////////////////////////////////////////////////////////////////////
+// See ReferenceArena. Needs the rest of the setup filled in first.
+void
+setup_reference_arena( ReferenceArena & arena, AlignmentSetup & setup ){
+	unsigned const num_sids = setup.RNA_sequences.size();
+	unsigned const num_expt_ids = setup.short_expt_ids.size();
+
+	size_t arena_size( 0 );
+	for ( unsigned e = 0; e < num_expt_ids; e++ ) arena_size += num_sids * ( length( setup.short_expt_ids[ e ] ) + length( setup.adapterSequenceRC ) );
+	for ( unsigned s = 0; s < num_sids; s++ ) arena_size += num_expt_ids * length( setup.RNA_sequences[ s ] );
+	if ( arena_size > reference_arena_max_size ) {
+		std::cout << "Too many sequence ID x expt ID combinations to set up references for read 2 in advance; will build them for each read." << std::endl;
+		return;
+	}
+
+	arena.num_expt_ids = num_expt_ids;
+	arena.references.resize( size_t( num_sids ) * num_expt_ids );
+	arena.mpos_max.resize( size_t( num_sids ) * num_expt_ids );
+	arena.cseq_pos.resize( size_t( num_sids ) * num_expt_ids );
+	for ( unsigned s = 0; s < num_sids; s++ ){
+		for ( unsigned e = 0; e < num_expt_ids; e++ ){
+			CharString & reference = arena.references[ size_t( s ) * num_expt_ids + e ];
+			reserve( reference, length( setup.RNA_sequences[ s ] ) + length( setup.short_expt_ids[ e ] ) + length( setup.adapterSequenceRC ), Exact() );
+			append( reference, setup.RNA_sequences[ s ] );
+			append( reference, setup.short_expt_ids[ e ] );
+			append( reference, setup.adapterSequenceRC );
+			arena.mpos_max[ size_t( s ) * num_expt_ids + e ] = get_mpos_max( reference, setup );
+			arena.cseq_pos[ size_t( s ) * num_expt_ids + e ] = try_exact_match( reference, setup.cseq );
+		}
+	}
+	arena.enabled = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+ReferenceArena::ReferenceArena():
+	enabled( false ),
+	num_expt_ids( 0 )
+{}
+
+
+////////////////////////////////////
+// anchor of each star sequence: its last star_anchor_length nts before the '*'. Star sequences
+// often share them [e.g., designs that differ only after the star], so each is kept once.
+void
+setup_star_anchors( String< CharString > & star_anchors,
+										std::vector< unsigned > & star_anchor_idx,
+										std::vector< CharString > const & sequences_before_star ){
+
+  clear( star_anchors );
+  star_anchor_idx.clear();
+  std::map< CharString, unsigned > anchor_idx;
+  for ( unsigned s = 0; s < sequences_before_star.size(); s++ ){
+    CharString const & sequence_before_star = sequences_before_star[ s ];
+    if ( length( sequence_before_star ) == 0 ) { // nothing to anchor on.
+      star_anchor_idx.push_back( no_star_anchor );
+      continue;
+    }
+    unsigned const anchor_length = std::min( unsigned( length( sequence_before_star ) ), star_anchor_length );
+    CharString const search_suffix = suffix( sequence_before_star, length( sequence_before_star ) - anchor_length );
+    if ( anchor_idx.find( search_suffix ) == anchor_idx.end() ) {
+      anchor_idx[ search_suffix ] = length( star_anchors );
+      appendValue( star_anchors, search_suffix );
+    }
+    star_anchor_idx.push_back( anchor_idx[ search_suffix ] );
+  }
+}
 
 ////////////////////////////////////
+// For each star sequence, the junk goes from the last hit of its anchor in read 1 that ends before the
+// primer binding site, up to the primer binding site. One pass of the Aho-Corasick automaton finds the
+// hits of all the anchors, in order of where they end.
 void
 check_for_extra_junk_using_star_sequences(
 																					std::vector< unsigned > & possible_sids,
 																					std::vector< CharString > & sequences_with_extra_junk,
 																					bool & extra_junk_mode,
-																					Finder<Index<THaystacks> > & finder_sequence_id,
+																					TStarAnchorPattern & star_anchor_pattern,
+																					std::vector< unsigned > const & star_anchor_idx,
+																					std::vector< int > & star_anchor_end_pos,
 																					CharString & seq1,
 																					unsigned const & constant_sequence_begin_pos,
 																					std::vector< CharString > const & sequences_before_star,
 																					std::vector< CharString > const & sequences_after_star,
 																					std::vector< unsigned > const & star_sequence_ids ){
 
+  if ( star_anchor_end_pos.size() == 0 ) return; // no star sequences.
+  // junk can't have negative length. [Primer binding site from a DP match that would begin before read 1.]
+  if ( int( constant_sequence_begin_pos ) < 0 ) return;
+
+  std::fill( star_anchor_end_pos.begin(), star_anchor_end_pos.end(), -1 );
+  Finder<String<char> > finder_star_anchors( seq1 ); // this is what to search.
+  String< CharString > const & star_anchors = host( star_anchor_pattern );
+  while ( find( finder_star_anchors, star_anchor_pattern ) ){
+    unsigned const k = position( star_anchor_pattern );
+    int const finder_end_pos = position( finder_star_anchors ) + length( star_anchors[ k ] );
+    if ( finder_end_pos > int( constant_sequence_begin_pos ) ) break; // and so are all the later ones.
+    star_anchor_end_pos[ k ] = finder_end_pos;
+  }
+
   for ( unsigned s = 0; s < star_sequence_ids.size(); s++ ){
-    // find it.
-    static int const min_length_of_sequence_before_star( 6 );
-    CharString sequence_before_star = sequences_before_star[ s ];
-    CharString search_suffix = suffix( sequence_before_star, length( sequence_before_star ) - min_length_of_sequence_before_star );
-    CharString extra_junk;
-    int star_pos( -1 );
-    Finder<String<char> > finder_constant_sequence(seq1); // this is what to search.
-    Pattern<String<char>, Horspool > pattern_constant_sequence( search_suffix );
-    while( find(finder_constant_sequence, pattern_constant_sequence) ){
-      int const finder_end_pos =  position( finder_constant_sequence )  + length( search_suffix );
-      if ( finder_end_pos < constant_sequence_begin_pos + 1 ) star_pos = finder_end_pos;
-      //if ( finder_end_pos < constant_sequence_begin_pos ) star_pos = finder_end_pos;
-      else break;
-    }
+    if ( star_anchor_idx[ s ] == no_star_anchor ) continue;
+    int const star_pos = star_anchor_end_pos[ star_anchor_idx[ s ] ];
     if (star_pos > -1 ){
       int extra_junk_length = constant_sequence_begin_pos - star_pos + 1;
       if ( extra_junk_length > 0 ){
-				extra_junk = infixWithLength( seq1, star_pos, extra_junk_length );
-				// what is the reconstructed sequence?
-				CharString sequence_with_extra_junk = sequence_before_star;
-				append( sequence_with_extra_junk, extra_junk );
-				CharString sequence_after_star = sequences_after_star[ s ];
-				append( sequence_with_extra_junk, sequence_after_star );
 				if (!extra_junk_mode ) {
 					if ( possible_sids.size() > 0 ) {
 						std::cerr << "cannot align to star/junk sequences if another option is available" << std::endl; exit( 0 );
 					}
 					extra_junk_mode = true;
 				}
+				// what is the reconstructed sequence? [reusing the string left over from an earlier read, if there is one.]
+				unsigned const n = possible_sids.size();
+				if ( sequences_with_extra_junk.size() <= n ) sequences_with_extra_junk.resize( n + 1 );
+				CharString & sequence_with_extra_junk = sequences_with_extra_junk[ n ];
+				sequence_with_extra_junk = sequences_before_star[ s ];
+				append( sequence_with_extra_junk, infixWithLength( seq1, star_pos, extra_junk_length ) );
+				append( sequence_with_extra_junk, sequences_after_star[ s ] );
 				possible_sids.push_back( star_sequence_ids[s] );
-				sequences_with_extra_junk.push_back( sequence_with_extra_junk );
 				// verbose = true;
       }
 
     }
-    //std::cout << "MYSTERY " << seq1 << " look for "  << search_suffix << " " << star_pos << " " << extra_junk << std::endl;
+    //std::cout << "MYSTERY " << seq1 << " star " << s << " at " << star_pos << std::endl;
   }
 }
 
-//////////////////////////////////////
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+//                       MAIN LOOP!                           //
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+// Threads take turns reading a batch of read pairs from the fastq files,
+// and then align their batch while the next thread reads.
+// TReader can read from a plain std::ifstream, one of the gzip streams, or a memory-mapped file.
+template < typename TReader >
 void
-output_stats_files( std::vector< std::vector< std::vector < double > > > const & all_count,
-										std::string const & outpath,
-										std::string const file_prefix )
-{
+align_fastq_files( TReader & reader1,
+									 TReader & reader2,
+									 ReadPairSelection & selection,
+									 AlignmentSetup & setup,
+									 Index<THaystacks> & index_sequence_id,
+									 Index<THaystacks> & index_expt_id,
+									 unsigned const seqCount_expt_id,
+									 unsigned const seqCount_library,
+									 std::vector< AlignmentWorker * > & workers ){
+
+	typedef typename FastqBatchSequence< TReader >::Type TBatchSequence;
+
+	// copied into each thread's worker.
+	MatchContext const match_context( setup );
+	unsigned const num_threads = workers.size();
+
+	// --dedup: first count up the distinct read pairs [see MAPseeker_dedup.h], then align each one once.
+	ReadPairTable read_pair_table;
+	if ( setup.dedup ) {
+		AlignmentWorker * direct_worker = 0; // for the odd read pair that can't be packed.
+		std::vector< TBatchSequence > batch_seq1( read_pair_batch_size ), batch_seq2( read_pair_batch_size );
+		unsigned num_in_batch( read_pair_batch_size );
+		ReadPairRecord record;
+		while ( num_in_batch == read_pair_batch_size ){
+			num_in_batch = read_in_batch( reader1, reader2, batch_seq1, batch_seq2, selection );
+			for ( unsigned n = 0; n < num_in_batch; n++ ){
+				if ( pack_read_pair( record, batch_seq1[ n ], batch_seq2[ n ] ) ) {
+					add_read_pair( read_pair_table, record );
+					continue;
+				}
+				if ( direct_worker == 0 ) {
+					direct_worker = new AlignmentWorker( index_sequence_id, index_expt_id, match_context, seqCount_expt_id, seqCount_library, setup.max_rna_len, setup.count_type, setup.count_storage, setup.profile );
+					workers.push_back( direct_worker );
+				}
+				align_read_pair( batch_seq1[ n ], batch_seq2[ n ], setup, *direct_worker );
+			}
+		}
+		if ( length( read_pair_table.spilled ) > 0 ) std::cout << "Sorting " << length( read_pair_table.spilled ) + read_pair_table.records.size() << " read pair records on disk" << std::endl;
+		finish_read_pair_table( read_pair_table );
+	}
 
-  unsigned const seqCount_expt_id = all_count.size();
-  std::cout << std::endl;
-  //////////////////////////////////////////////////////
-  //  output matrices with stored counts.
-  //////////////////////////////////////////////////////
-  for ( unsigned i = 0; i < seqCount_expt_id; i++ ){
-    char stats_outFileName[ 100 ];
-    sprintf( stats_outFileName, "%s%s_ID%d.txt", outpath.c_str(), file_prefix.c_str(), i+1 ); // index by 1.
-    std::cout << "Outputting counts to: " << stats_outFileName << std::endl;
-    FILE * stats_oFile;
-    stats_oFile = fopen( stats_outFileName,"w");
-
-    unsigned const seqCount_library = all_count[i].size();
-    for ( unsigned j = 0; j < seqCount_library; j++ ){
-      double total_for_RNA( 0.0 );
-
-      unsigned const max_rna_len_plus_one = all_count[i][j].size();
-      for ( unsigned k = 0; k < (max_rna_len_plus_one); k++ ){
-				fprintf( stats_oFile, " %10.3f", all_count[i][j][k] );
-				total_for_RNA += all_count[i][j][k];
-      }
-      //      std::cout << i << " " << j << " " << all_count[i][j][0] << " " << max_rna_len_plus_one << " " << total_for_RNA << " " << std::endl; // was used to check if total was integer.
-      fprintf( stats_oFile, "\n");
-    }
-    fclose( stats_oFile );
-  }
+	SEQAN_OMP_PRAGMA( parallel num_threads( num_threads ) )
+	{
+		AlignmentWorker * worker = new AlignmentWorker( index_sequence_id, index_expt_id, match_context, seqCount_expt_id, seqCount_library, setup.max_rna_len, setup.count_type, setup.count_storage, setup.profile );
+		workers[ omp_get_thread_num() ] = worker;
+
+		if ( setup.dedup ) {
+			std::vector< ReadPairRecord > batch( read_pair_batch_size );
+			unsigned num_in_batch( read_pair_batch_size );
+
+			while ( num_in_batch == read_pair_batch_size ){
+				SEQAN_OMP_PRAGMA( critical (read_fastq) )
+				{
+					ScopedProfileTimer timer( worker->profile, READ_FASTQ_STAGE );
+					num_in_batch = 0;
+					while ( num_in_batch < read_pair_batch_size && get_next_unique_read_pair( read_pair_table, batch[ num_in_batch ] ) ) num_in_batch++;
+				}
+				for ( unsigned n = 0; n < num_in_batch; n++ ) {
+					unpack_read_pair( worker->seq1, worker->seq2, batch[ n ] );
+					align_read_pair( worker->seq1, worker->seq2, setup, *worker, batch[ n ].multiplicity );
+				}
+			}
+		} else {
+			std::vector< TBatchSequence > batch_seq1( read_pair_batch_size ), batch_seq2( read_pair_batch_size );
+			unsigned num_in_batch( read_pair_batch_size );
+
+			while ( num_in_batch == read_pair_batch_size ){
+				SEQAN_OMP_PRAGMA( critical (read_fastq) )
+				{
+					ScopedProfileTimer timer( worker->profile, READ_FASTQ_STAGE );
+					num_in_batch = read_in_batch( reader1, reader2, batch_seq1, batch_seq2, selection );
+				}
+				for ( unsigned n = 0; n < num_in_batch; n++ ) align_read_pair( batch_seq1[ n ], batch_seq2[ n ], setup, *worker );
+			}
+		}
+	}
+
+	if ( setup.dedup ) std::cout << "Aligned " << read_pair_table.num_unique_read_pairs << " distinct read pairs, out of " << read_pair_table.num_read_pairs << std::endl;
+}
+
+////////////////////////////////////////////////////////////////
+ReadPairSelection::ReadPairSelection( unsigned const start_at_read_,
+																			unsigned const increment_between_reads_ ):
+	start_at_read( start_at_read_ ),
+	increment_between_reads( increment_between_reads_ ),
+	read_count( 0 ),
+	done( false ),
+	read_error( false )
+{}
+
+////////////////////////////////////////////////////////////////
+// Reads in the next batch of read pairs that this job should align, skipping
+// over (but not parsing) the ones that belong to other jobs. Returns how many were read.
+// Not thread-safe -- only one thread should call this at a time.
+template < typename TReader >
+unsigned
+read_in_batch( TReader & reader1,
+							 TReader & reader2,
+							 std::vector< CharString > & batch_seq1,
+							 std::vector< CharString > & batch_seq2,
+							 ReadPairSelection & selection ){
+
+	String<char> qual1,qual2,id1,id2;
+	unsigned num_in_batch( 0 );
+	while ( num_in_batch < batch_seq1.size() && !selection.done ){
+		if ( atEnd(reader1) || atEnd(reader2) ) {
+			selection.done = true;
+			break;
+		}
+
+		unsigned long const read_idx = selection.read_count++;
+		if ( read_idx < selection.start_at_read ||
+				 ( read_idx - selection.start_at_read ) % selection.increment_between_reads != 0 ){
+			if ( skip_fastq_record( reader1 ) != 0 || skip_fastq_record( reader2 ) != 0 ) selection.done = true;
+			continue;
+		}
+
+		if (readRecord(id1, batch_seq1[ num_in_batch ], qual1, reader1, seqan::Fastq()) != 0 ||
+				readRecord(id2, batch_seq2[ num_in_batch ], qual2, reader2, seqan::Fastq()) != 0 ) {
+			selection.read_error = true;
+			selection.done = true;
+			break;
+		}
+
+		// in --byte_range mode, stop when we hit the first read of the next job.
+		if ( selection.stop_at_read_name.size() > 0 && get_read_name( id1 ) == selection.stop_at_read_name ) {
+			selection.done = true;
+			break;
+		}
+		num_in_batch++;
+	}
+	return num_in_batch;
+}
+
+////////////////////////////////////////////////////////////////
+// Same as above, for memory-mapped fastq files. Here the batch just gets views of the
+// sequence lines, and read ids and qualities are skipped over without being copied.
+unsigned
+read_in_batch( TFastqMMapReader & reader1,
+							 TFastqMMapReader & reader2,
+							 std::vector< TFastqMMapView > & batch_seq1,
+							 std::vector< TFastqMMapView > & batch_seq2,
+							 ReadPairSelection & selection ){
+
+	TFastqMMapView id1, id2;
+	unsigned num_in_batch( 0 );
+	while ( num_in_batch < batch_seq1.size() && !selection.done ){
+		if ( atEnd(reader1) || atEnd(reader2) ) {
+			selection.done = true;
+			break;
+		}
+
+		if ( read_fastq_record_view( reader1, id1, batch_seq1[ num_in_batch ] ) != 0 ||
+				 read_fastq_record_view( reader2, id2, batch_seq2[ num_in_batch ] ) != 0 ) {
+			selection.read_error = true;
+			selection.done = true;
+			break;
+		}
+
+		// in --byte_range mode, stop when we hit the first read of the next job.
+		if ( selection.stop_at_read_name.size() > 0 && get_read_name( id1 ) == selection.stop_at_read_name ) {
+			selection.done = true;
+			break;
+		}
+
+		unsigned long const read_idx = selection.read_count++;
+		if ( read_idx < selection.start_at_read ||
+				 ( read_idx - selection.start_at_read ) % selection.increment_between_reads != 0 ) continue;
+
+		num_in_batch++;
+	}
+	return num_in_batch;
+}
+
+////////////////////////////////////////////////////////////////
+// Finds the id and sequence lines of the next (four-line) fastq record in the mapped file,
+// just by scanning for newlines. Returns nonzero if the record is not in fastq format.
+int
+read_fastq_record_view( TFastqMMapReader & reader, TFastqMMapView & id, TFastqMMapView & seq ){
+
+	char const * const file_begin = begin( reader._string, Standard() );
+	char const * const file_end = reader._end;
+	char const * line_begin = reader._current;
+	if ( line_begin == file_end || *line_begin != '@' ) return 1;
+
+	for ( unsigned n = 0; n < 4; n++ ){
+		if ( line_begin == file_end ) return 1;
+		char const * line_end = (char const *) memchr( line_begin, '\n', file_end - line_begin );
+		char const * next_line_begin = ( line_end == NULL ) ? file_end : line_end + 1;
+		if ( line_end == NULL ) line_end = file_end;
+		if ( line_end > line_begin && *( line_end - 1 ) == '\r' ) line_end--; // Windows line endings.
+
+		if ( n == 0 ) id = infix( reader._string, line_begin + 1 - file_begin, line_end - file_begin );
+		if ( n == 1 ) seq = infix( reader._string, line_begin - file_begin, line_end - file_begin );
+		if ( n == 2 && *line_begin != '+' ) return 1;
+		line_begin = next_line_begin;
+	}
+	reader._current = begin( reader._string, Standard() ) + ( line_begin - file_begin );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// four lines per record -- always true for Illumina.
+template < typename TReader >
+int
+skip_fastq_record( TReader & reader ){
+	for ( unsigned n = 0; n < 4; n++ ){
+		int const res = skipLine( reader );
+		if ( res != 0 ) return res;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// Read names in read 1 and read 2 files match up to the first whitespace (or up to /1, /2 in older Illumina formats).
+template < typename TId >
+std::string
+get_read_name( TId const & id ){
+	std::string name;
+	for ( unsigned n = 0; n < length( id ); n++ ){
+		if ( id[n] == ' ' || id[n] == '\t' ) break;
+		name += id[n];
+	}
+	if ( name.size() > 2 && name[ name.size()-2 ] == '/' ) name.resize( name.size()-2 );
+	return name;
+}
+
+////////////////////////////////////////////////////////////////
+// Moves stream to the beginning of the first fastq record that starts at or after byte_offset.
+// A record starts at a line beginning with '@', if the line two after it begins with '+'
+// [just checking for '@' is not enough, since quality lines can start with '@'].
+// Returns false if there is no such record.
+bool
+seek_to_fastq_record( std::ifstream & fastq, std::streamoff const byte_offset ){
+
+	std::string line, line2, line3;
+	fastq.clear();
+	if ( byte_offset > 0 ) {
+		// finish off the line that byte_offset is in, unless byte_offset is already at the start of a line.
+		fastq.seekg( byte_offset - 1 );
+		std::getline( fastq, line );
+	} else {
+		fastq.seekg( 0 );
+	}
+
+	while ( fastq.good() ){
+		std::streampos const record_start = fastq.tellg();
+		if ( !std::getline( fastq, line ) ) break;
+		if ( line.size() == 0 || line[0] != '@' ) continue;
+
+		std::streampos const next_line_start = fastq.tellg();
+		if ( !std::getline( fastq, line2 ) || !std::getline( fastq, line3 ) ) break;
+		if ( line3.size() > 0 && line3[0] == '+' ) {
+			fastq.clear();
+			fastq.seekg( record_start );
+			return true;
+		}
+		fastq.seekg( next_line_start );
+	}
+	fastq.clear();
+	return false;
+}
+
+////////////////////////////////////////////////////////////////
+// name of the record the stream is at, without moving the stream.
+std::string
+get_fastq_record_name( std::ifstream & fastq ){
+	std::streampos const record_start = fastq.tellg();
+	std::string line;
+	std::getline( fastq, line );
+	fastq.clear();
+	fastq.seekg( record_start );
+	if ( line.size() == 0 ) return "";
+	return get_read_name( CharString( line.substr( 1 ) ) );
+}
+
+////////////////////////////////////////////////////////////////
+// Read 2 file has records in the same order as read 1 file, but not at the same byte offsets. Look for
+//  the record with the right name, in a window around the guessed offset that grows until we find it.
+bool
+seek_to_fastq_record_with_name( std::ifstream & fastq, std::string const & name, std::streamoff const guess_offset ){
+
+	fastq.seekg( 0, std::ios_base::end );
+	std::streamoff const file_size = fastq.tellg();
+
+	std::string line;
+	std::streamoff window( 1 << 20 );
+	while ( true ){
+		std::streamoff const window_begin = ( guess_offset > window ) ? guess_offset - window : 0;
+		std::streamoff const window_end   = guess_offset + window;
+		if ( seek_to_fastq_record( fastq, window_begin ) ){
+			while ( fastq.good() && std::streamoff( fastq.tellg() ) <= window_end ){
+				std::streampos const record_start = fastq.tellg();
+				if ( get_fastq_record_name( fastq ) == name ){
+					fastq.seekg( record_start );
+					return true;
+				}
+				for ( unsigned n = 0; n < 4; n++ ) std::getline( fastq, line );
+			}
+		}
+		if ( window_begin == 0 && window_end >= file_size ) break;
+		window *= 4;
+	}
+	fastq.clear();
+	return false;
 }
 
+////////////////////////////////////////////////////////////////
+// --byte_range i/N. Positions both fastq files at the first read pair of the i-th of N slices of the read 1 file,
+// and records the name of the first read in the next slice, so that we know when to stop.
+// This way each job only reads through its own part of the files.
+void
+seek_to_byte_range( std::ifstream & fastq1,
+										std::ifstream & fastq2,
+										unsigned const job_idx,
+										unsigned const num_jobs,
+										ReadPairSelection & selection ){
+
+	fastq1.seekg( 0, std::ios_base::end );
+	std::streamoff const file_size1 = fastq1.tellg();
+	fastq2.seekg( 0, std::ios_base::end );
+	std::streamoff const file_size2 = fastq2.tellg();
+
+	std::streamoff const slice_begin = file_size1 / num_jobs * job_idx;
+	std::streamoff const slice_end   = file_size1 / num_jobs * ( job_idx + 1 );
+
+	if ( job_idx + 1 < num_jobs && seek_to_fastq_record( fastq1, slice_end ) ) {
+		selection.stop_at_read_name = get_fastq_record_name( fastq1 );
+	}
+
+	if ( !seek_to_fastq_record( fastq1, slice_begin ) ){
+		selection.done = true; // nothing left for this job.
+		return;
+	}
+	std::streamoff const record_begin1 = fastq1.tellg();
+	std::string const first_read_name = get_fastq_record_name( fastq1 );
+	if ( first_read_name == selection.stop_at_read_name ){
+		selection.done = true; // slice is smaller than one record.
+		return;
+	}
+
+	std::streamoff const guess_offset2 = std::streamoff( double( record_begin1 ) / file_size1 * file_size2 );
+	if ( !seek_to_fastq_record_with_name( fastq2, first_read_name, guess_offset2 ) ){
+		std::cerr << "ERROR! Could not find read " << first_read_name << " in read 2 file." << std::endl; exit( 0 );
+	}
+	std::cout << "Aligning byte range " << job_idx << "/" << num_jobs << " starting at read " << first_read_name << std::endl;
+}
 
 bool
 already_saved( std::vector< unsigned > const & mpos_vector,
@@ -1,8 +1,17 @@
+#include <map>
 #include <seqan/find.h>
 #include <seqan/find.h>
 #include <seqan/index.h>
 #include <seqan/store.h>
 #include <seqan/basic.h>
+#include <seqan/parallel.h>
+#include <seqan/file.h>
+#include <seqan/stream.h>
+#include <apps/MAPseeker_counts.h>
+#include <apps/MAPseeker_dedup.h>
+#include <apps/MAPseeker_read2_cache.h>
+#include <apps/MAPseeker_read2_seed.h>
+#include <apps/MAPseeker_myers_simd.h>
 
 using namespace seqan;
 
@@ -10,6 +19,412 @@ using namespace seqan;
 //We will generate an index against this file to make the search faster
 typedef StringSet<CharString> THaystacks;
 
+// how many read pairs a thread reads in from the fastq files at a time, before aligning them.
+unsigned const read_pair_batch_size( 1000 );
+
+// --mmap: uncompressed fastq files get mapped into memory, and batches just hold views of the
+// sequence lines in the mapping, instead of copies of each record.
+typedef String<char, MMap<> > TFastqMMap;
+typedef RecordReader< TFastqMMap, SinglePass<StringReader> > TFastqMMapReader;
+typedef Infix< TFastqMMap >::Type TFastqMMapView;
+
+// What a batch holds for each read -- a copy of the sequence, or a view into the mapped file.
+template < typename TReader >
+struct FastqBatchSequence {
+	typedef CharString Type;
+};
+
+template <>
+struct FastqBatchSequence< TFastqMMapReader > {
+	typedef TFastqMMapView Type;
+};
+
+// --profile: the stages of align_read_pair() that get timed, in cascade order. Fallbacks only get
+// called for read pairs that fell through the stages before them, so their call counts say how many did.
+enum AlignmentStage {
+	READ_FASTQ_STAGE,        // reading in a batch of read pairs [per batch, not per read pair].
+	READ_PAIR_STAGE,         // all of align_read_pair(), including the stages below.
+	PRIMER_SITE_STAGE,       // DP search for cseq in read 1.
+	EXPT_ID_STAGE,
+	SEQUENCE_ID_STAGE,       // find_possible_sids() and disambiguation.
+	SHORT_INSERT_STAGE,      // -A fallback: check_for_short_insert().
+	SINGLE_NT_VARIANT_STAGE, // -x fallback.
+	STAR_JUNK_STAGE,         // fallback for library sequences with '*'.
+	HAIL_MARY_STAGE,         // -A fallback: try all star sequences.
+	READ2_STAGE,             // DP (-D) or Myers search of read 2 against each candidate sequence.
+	NUM_ALIGNMENT_STAGES
+};
+
+std::string const alignment_stage_names[ NUM_ALIGNMENT_STAGES ] = {
+	"read_fastq", "read_pair", "primer_site", "expt_id", "sequence_id",
+	"short_insert", "single_nt_variant", "star_junk", "hail_mary", "read2"
+};
+
+// Filters of the purification table, in cascade order, plus the tallies printed after it.
+enum PurificationCounter {
+	TOTAL_COUNTER,
+	PRIMER_SITE_COUNTER,
+	EXPT_ID_COUNTER,
+	READ1_COUNTER,
+	READ2_COUNTER,
+	STRICT_COUNTER,
+	NULL_LIGATION_COUNTER,
+	PERFECT_COUNTER,
+	READ2_SEARCH_COUNTER, // read 2 looked for in the references [not in the read 2 cache].
+	READ2_SEED_COUNTER,   // ... and placed by its seed alone.
+	NUM_PURIFICATION_COUNTERS
+};
+
+unsigned const num_purification_filters( STRICT_COUNTER + 1 ); // rows of the purification table.
+
+std::string const purification_counter_tags[ NUM_PURIFICATION_COUNTERS ] = {
+	"total",
+	"found primer binding site",
+	"found expt ID site",
+	"found match in RNA sequence (read 1)",
+	"found match in RNA sequence (read 2)",
+	"found strict match in RNA sequence (read 2)",
+	"null ligations",
+	"perfect constant sequence",
+	"read 2 searched",
+	"read 2 placed by seed"
+};
+
+// How many read pairs pass through each filter, broken down by experimental ID. Column 0 holds
+// read pairs counted before their expt ID is known [total, primer binding site, perfect], so
+// column expt_idx+1 holds expt ID expt_idx. Each thread keeps its own; summed up at the end.
+struct PurificationTable {
+	unsigned num_expt_ids;
+	std::vector< unsigned long > counts; // [ counter ][ expt_idx+1 ]
+};
+
+// Hash table from short DNA sequences, packed 3 bits per nucleotide (see pack_sequence), to an index.
+// Open addressing with linear probing; grows as needed.
+struct PackedSequenceHash {
+	PackedSequenceHash();
+
+	std::vector< __uint64 > keys;
+	std::vector< int > values;
+	unsigned num_entries;
+};
+
+// Experimental IDs are classified by looking up pieces of read 1 in two tables, built once at startup:
+//  exact_matches: every substring of every expt ID --> what an exact search of the index of expt IDs returns for it;
+//  edit_matches:  every sequence within 2 edits of an expt ID --> the last such expt ID [same as try_DP_match_expt_ids()].
+// This takes about the same time no matter how many primers there are. Disabled if expt IDs are too long to pack,
+// or have characters other than A,C,G,T,N; then we fall back to the index and DP search.
+struct ExptIdClassifier {
+	ExptIdClassifier();
+
+	bool enabled;
+	std::vector< bool > is_query_length; // lengths of pieces of read 1 that could be within 2 edits of an expt ID.
+	unsigned max_expt_id_length;
+	PackedSequenceHash exact_matches, edit_matches;
+};
+
+// Sequence IDs are looked up in a table instead of the index of RNA sequences. The only windows of seqid_length nts
+// in read 1 that can hit are ones followed by cseq in some RNA, so at startup we run the index search once for
+// each of those windows and keep the (sid, begin position) hits, in the same order. Windows are packed 2 bits per nt.
+// With --match_single_nt_variants, also keeps the hits of all single-nt variants of each window that
+// get_next_variant() would try, so that one lookup replaces the variant loop.
+// Disabled if windows are too long to pack, or have characters other than A,C,G,T; then we fall back to the index.
+struct SequenceIdTable {
+	SequenceIdTable();
+
+	bool enabled;
+	unsigned seqid_length;
+	PackedSequenceHash windows, variant_windows; // packed window --> index into hit lists below.
+	std::vector< std::vector< unsigned > > sids, begpos, variant_sids, variant_begpos;
+};
+
+// Read 2 gets aligned to the RNA followed by the expt ID and adapter from the RT primer. These references depend
+// only on (sequence ID, expt ID), so they are built once at startup, along with how far into each one an RT stop
+// can be [mpos_max]. Read-only after that, so any number of threads can share them. [Each is its own string,
+// as seqan's findBegin() can't search an infix of one big string.]
+// Disabled if they would take more than reference_arena_max_size characters; then references get built for each read.
+struct ReferenceArena {
+	ReferenceArena();
+
+	bool enabled;
+	unsigned num_expt_ids;
+	std::vector< CharString > references; // [ sid * num_expt_ids + expt_idx ]
+	std::vector< int > mpos_max;
+	std::vector< int > cseq_pos; // where the primer binding site starts [-1 if not there].
+};
+
+size_t const reference_arena_max_size( 1 << 28 );
+
+// Everything the main loop needs that does not change from read to read.
+// Filled in once during setup, then shared by all threads, which must not modify it -- except for
+// read2_cache, which locks its own shards. (Passed around as non-const only because seqan's DPSearch
+// patterns won't take const needles.)
+struct AlignmentSetup {
+	std::vector< CharString > RNA_sequences;
+	std::vector< CharString > short_expt_ids;
+	std::vector< CharString > sequences_before_star, sequences_after_star;
+	std::vector< unsigned > star_sequence_ids;
+	CharString cseq, adapterSequenceRC, adapterSequence2;
+	unsigned seqid_length, max_rna_len;
+	unsigned read2_length; // align only this much of read 2 [0: all of it].
+	unsigned read2_window; // --read2_window: slack around the RT stops read 1 allows [0: off].
+	bool match_single_nt_variants, match_DP, align_all, align_null, strict, profile, dedup;
+	CountType count_type;
+	CountStorage count_storage;
+	ExptIdClassifier expt_id_classifier;
+	SequenceIdTable sequence_id_table;
+	ReferenceArena reference_arena;
+	Read2Cache read2_cache;
+	Read2SeedIndex read2_seed_index; // needs the reference_arena.
+	MultiTextMyersKernel myers_kernel; // picked for this CPU.
+};
+
+typedef Pattern<String<char>, DPSearch<SimpleScore> > TDPPattern;
+typedef Pattern<String<char>, Myers< FindInfix > > TRead2Pattern;
+// The primer binding site is scored like DPSearch with SimpleScore( 0, -2, -1 ), where a mismatch costs as much as
+// an insertion plus a deletion -- so the score is minus the number of indels, which a bit-parallel search gets exactly.
+typedef Pattern<String<char>, IndelShiftAnd> TCseqPattern;
+
+// Star/junk sequences are found in read 1 by the last few nts before the '*' [their anchor].
+// All the distinct anchors get searched for at once, with an Aho-Corasick automaton.
+unsigned const star_anchor_length( 6 );
+unsigned const no_star_anchor( ~0u );
+typedef Pattern<String<CharString>, AhoCorasick> TStarAnchorPattern;
+
+// The DP patterns searched for in read 1 are the same for every read, so they are set up once
+// instead of per read. Each thread gets its own copy, since searching overwrites a pattern's DP column.
+struct MatchContext {
+	MatchContext( AlignmentSetup & setup );
+
+	TCseqPattern cseq_pattern; // primer binding site.
+	std::vector< TDPPattern > expt_id_patterns;
+	// reverse complement of the first n nts of adapter sequence 2, for each n (0 is unused).
+	std::vector< TDPPattern > adapter2_patterns;
+	// distinct anchors of the star sequences, and which one each star sequence has [or no_star_anchor].
+	String< CharString > star_anchors;
+	std::vector< unsigned > star_anchor_idx;
+};
+
+// Buffers for the pieces of one read pair that align_read_pair() works with. They live in the worker
+// and get reused from one read pair to the next, keeping their capacity, so that once they have grown
+// to the longest reads, aligning a read pair does not touch the heap.
+struct AlignmentScratch {
+	CharString expt_id_in_read1, sequence_id_region_in_sequence1, sequence_id_region_variant;
+	CharString sequence_id_in_read1; // for check_for_short_insert().
+	std::vector< unsigned > possible_sids, possible_begpos;
+	// one per possible sid in extra junk mode; may hold leftovers from earlier reads beyond that.
+	std::vector< CharString > sequences_with_extra_junk;
+	std::vector< unsigned > mpos_vector, sid_vector;
+	std::vector< int > star_anchor_end_pos; // for each of the star_anchors.
+	// read 2, set up as a pattern once per read, then searched for in each possible reference.
+	TRead2Pattern read2_pattern;
+	TDPPattern read2_DP_pattern; // --match_DP
+	MultiTextMyersPattern read2_multi_text_pattern;
+	// for find_read2_placements(): the possible references and how far into them RT stops can be, read 2's
+	// best score in each, and references built for this read, when they can't come from the ReferenceArena.
+	std::vector< CharString * > references;
+	std::vector< int > mpos_max, cseq_pos;
+	std::vector< int > window_begin, last_mpos; // the part of each reference read 2 can be placed in [--read2_window].
+	std::vector< unsigned > best_errors;
+	std::vector< int > best_end;
+	std::vector< CharString > reference_buffers;
+	CharString read2_window; // the part of a reference that read 2 gets searched for in.
+	std::vector< std::pair< unsigned, int > > read2_seed_hits; // sid and position of exact occurrences of read 2.
+};
+
+// Everything one thread changes while aligning: its own finders into the (shared) indices, its own
+// copy of the patterns, and its own counts, which get summed up over threads at the end with merge_counts().
+struct AlignmentWorker {
+	AlignmentWorker( Index<THaystacks> & index_sequence_id,
+									 Index<THaystacks> & index_expt_id,
+									 MatchContext const & match_context,
+									 unsigned const seqCount_expt_id,
+									 unsigned const seqCount_library,
+									 unsigned const max_rna_len,
+									 CountType const count_type,
+									 CountStorage const count_storage,
+									 bool const profile );
+
+	Finder<Index<THaystacks> > finder_sequence_id, finder_expt_id;
+	MatchContext match_context;
+	// built from match_context.star_anchors -- lives here, as seqan won't copy it.
+	TStarAnchorPattern star_anchor_pattern;
+	// histogram recording the counts [convenient for plotting in matlab, R, etc.]
+	CountTensor all_count;
+	// keep track of how many sequences pass through each filter
+	PurificationTable purification;
+	// --profile timers for the stages of align_read_pair() [see AlignmentStage].
+	ProfileStageTimes profile;
+	// copies of the current read pair, when the batch only holds views.
+	CharString seq1, seq2;
+	AlignmentScratch scratch;
+};
+
+// Which read pairs in the fastq files this job should align, for splitting up a run over cluster jobs.
+// Also keeps track of where the (shared) fastq readers are.
+struct ReadPairSelection {
+	ReadPairSelection( unsigned const start_at_read_, unsigned const increment_between_reads_ );
+
+	unsigned start_at_read, increment_between_reads;
+	std::string stop_at_read_name; // --byte_range: first read 1 of the next job, if there is one.
+	unsigned long read_count; // read pairs gone through so far, including skipped ones.
+	bool done, read_error;
+};
+
+template < typename TReader >
+void
+align_fastq_files( TReader & reader1,
+									 TReader & reader2,
+									 ReadPairSelection & selection,
+									 AlignmentSetup & setup,
+									 Index<THaystacks> & index_sequence_id,
+									 Index<THaystacks> & index_expt_id,
+									 unsigned const seqCount_expt_id,
+									 unsigned const seqCount_library,
+									 std::vector< AlignmentWorker * > & workers );
+
+template < typename TReader >
+unsigned
+read_in_batch( TReader & reader1,
+							 TReader & reader2,
+							 std::vector< CharString > & batch_seq1,
+							 std::vector< CharString > & batch_seq2,
+							 ReadPairSelection & selection );
+
+unsigned
+read_in_batch( TFastqMMapReader & reader1,
+							 TFastqMMapReader & reader2,
+							 std::vector< TFastqMMapView > & batch_seq1,
+							 std::vector< TFastqMMapView > & batch_seq2,
+							 ReadPairSelection & selection );
+
+int
+read_fastq_record_view( TFastqMMapReader & reader, TFastqMMapView & id, TFastqMMapView & seq );
+
+template < typename TReader >
+int
+skip_fastq_record( TReader & reader );
+
+template < typename TId >
+std::string
+get_read_name( TId const & id );
+
+bool
+seek_to_fastq_record( std::ifstream & fastq, std::streamoff const byte_offset );
+
+std::string
+get_fastq_record_name( std::ifstream & fastq );
+
+bool
+seek_to_fastq_record_with_name( std::ifstream & fastq, std::string const & name, std::streamoff const guess_offset );
+
+void
+seek_to_byte_range( std::ifstream & fastq1,
+										std::ifstream & fastq2,
+										unsigned const job_idx,
+										unsigned const num_jobs,
+										ReadPairSelection & selection );
+
+void
+align_read_pair( CharString & seq1,
+								 CharString & seq2,
+								 AlignmentSetup & setup,
+								 AlignmentWorker & worker,
+								 unsigned const multiplicity = 1 );
+
+bool
+find_read2_placements( CharString & seq2,
+											 std::vector< unsigned > const & possible_sids,
+											 std::vector< CharString > const & sequences_with_extra_junk,
+											 bool const extra_junk_mode,
+											 int const expt_idx,
+											 AlignmentSetup & setup,
+											 int const min_fragment_length,
+											 int const max_fragment_length,
+											 std::vector< unsigned > & mpos_vector,
+											 std::vector< unsigned > & sid_vector,
+											 int & mscr,
+											 AlignmentScratch & scratch,
+											 bool const verbose );
+
+bool
+place_read2_by_seed( CharString & seq2,
+										 std::vector< unsigned > const & possible_sids,
+										 int const expt_idx,
+										 AlignmentSetup & setup,
+										 std::vector< int > const & window_begin,
+										 std::vector< int > const & mpos_max,
+										 std::vector< unsigned > & mpos_vector,
+										 std::vector< unsigned > & sid_vector,
+										 int & mscr,
+										 AlignmentScratch & scratch );
+
+int
+get_mpos_max( CharString & seq_from_library, AlignmentSetup & setup );
+
+void
+get_fragment_length_in_read1( std::vector< TDPPattern > & adapter2_patterns,
+															CharString & seq1,
+															int const constant_sequence_begin_pos,
+															unsigned const seqid_length,
+															int & min_fragment_length,
+															int & max_fragment_length );
+
+void
+search_read2_in_reference( CharString & reference,
+													 int const window_begin,
+													 int const mpos_max,
+													 unsigned const sid_idx,
+													 CharString & seq2,
+													 TRead2Pattern & read2_pattern,
+													 TDPPattern & read2_DP_pattern,
+													 AlignmentSetup & setup,
+													 std::vector< unsigned > & mpos_vector,
+													 std::vector< unsigned > & sid_vector,
+													 int & mscr,
+													 bool const verbose );
+
+template < typename TSeqView >
+void
+align_read_pair( TSeqView const & seq1,
+								 TSeqView const & seq2,
+								 AlignmentSetup & setup,
+								 AlignmentWorker & worker );
+
+void
+merge_counts( AlignmentWorker const & worker,
+							CountTensor & all_count,
+							PurificationTable & purification,
+							ProfileStageTimes & profile );
+
+void
+resize_purification_table( PurificationTable & purification, unsigned const num_expt_ids );
+
+inline void
+record_counter( PurificationTable & purification, PurificationCounter const counter, int const expt_idx = -1, unsigned const multiplicity = 1 ){
+	purification.counts[ counter * ( purification.num_expt_ids + 1 ) + ( expt_idx + 1 ) ] += multiplicity;
+}
+
+unsigned long
+get_counter( PurificationTable const & purification, PurificationCounter const counter, int const expt_idx );
+
+unsigned long
+get_counter_total( PurificationTable const & purification, PurificationCounter const counter );
+
+void
+merge_purification_tables( PurificationTable & purification, PurificationTable const & other );
+
+void
+output_purification_table( PurificationTable const & purification,
+													 std::vector< std::string > const & expt_id_names,
+													 bool const align_all,
+													 bool const read2_seed );
+
+void
+output_profile_report( ProfileStageTimes const & profile,
+											 unsigned const num_threads,
+											 double const align_time,
+											 std::string const & outpath );
+
 int
 get_number_of_matching_residues( std::vector< CharString > const & seq_primers );
 
@@ -17,16 +432,36 @@ get_number_of_matching_residues( std::vector< CharString > const & seq_primers )
 void RNA2DNA( String<char> & seq );
 int findchar( String<char> & seq, char c );
 
-// could package into a little class:
-void record_counter( std::string const tag,
-		     unsigned & counter_idx,
-		     std::vector< unsigned > & counter_counts,
-		     std::vector< std::string > & counter_tags );
-
 int try_exact_match( CharString & seq1, CharString & cseq, unsigned & perfect );
 int try_exact_match( CharString & seq1, CharString & cseq );
-int try_DP_match( CharString & seq1, CharString & cseq, unsigned & perfect );
-int try_DP_match_expt_ids( std::vector< CharString > & short_expt_ids, CharString & expt_id_in_read1 );
+int try_DP_match( CharString & seq1, TCseqPattern & pattern_constant_sequence_DP, unsigned & perfect );
+int try_DP_match_expt_ids( std::vector< TDPPattern > & expt_id_patterns, CharString & expt_id_in_read1 );
+
+void
+setup_expt_id_classifier( ExptIdClassifier & classifier,
+													std::vector< CharString > const & short_expt_ids,
+													Index<THaystacks> & index_expt_id );
+
+void
+add_edit_neighbors( PackedSequenceHash & edit_matches, std::string const & seq, int const expt_idx, unsigned const num_edits );
+
+int
+classify_expt_id( ExptIdClassifier const & classifier, CharString const & expt_id_in_read1 );
+
+__uint64
+pack_sequence( std::string const & seq );
+
+unsigned
+pack_nucleotide( char const c );
+
+int &
+hash_value( PackedSequenceHash & hash, __uint64 const key );
+
+int
+find_hash_value( PackedSequenceHash const & hash, __uint64 const key );
+
+void
+rehash( PackedSequenceHash & hash, unsigned const new_size );
 
 bool
 get_next_variant( CharString const & seq, CharString & seq_var, unsigned & variant_counter, unsigned const & seqid_length );
@@ -43,6 +478,7 @@ void
 figure_out_expt_IDs( std::string const & file_primers,
 		     std::string const & file_expt_id,
 		     std::vector< String<char> > & short_expt_ids,
+		     std::vector< std::string > & expt_id_names,
 		     THaystacks & haystacks_expt_ids,
 		     CharString & cseq,
 		     CharString & adapterSequence );
@@ -53,6 +489,13 @@ read_in_fastq( MultiSeqFile & multiSeqFile1,
 	       std::string const & file1,
 	       unsigned & seqCount1 );
 
+// orders library members (by index) by their sequences, for check_unique_id().
+struct LibrarySequenceLess {
+	LibrarySequenceLess( std::vector< String<char> > const & sequences_ ): sequences( sequences_ ) {}
+	bool operator()( unsigned const a, unsigned const b ) const { return sequences[ a ] < sequences[ b ]; }
+	std::vector< String<char> > const & sequences;
+};
+
 void
 check_unique_id(  std::vector< String<char> > const & rna_library_vector_RC,
 		  CharString const & cseq,
@@ -66,14 +509,21 @@ disambiguate_possible_sids( std::vector< unsigned > & possible_sids,
 			    CharString const & seq1,
 			    std::vector< CharString > const & RNA_sequences );
 
+unsigned
+get_number_of_matches_before_sequence_id( CharString const & seq1,
+					  unsigned const min_pos,
+					  CharString const & seq_from_library,
+					  unsigned const begpos );
+
 void
-check_for_short_insert( CharString const & adapterSequence2,
+check_for_short_insert( std::vector< TDPPattern > & adapter2_patterns,
 			CharString const & cseq,
 			unsigned const & constant_sequence_begin_pos,
 			unsigned const & seqid_length,
 			CharString & seq1,
 			Finder<Index<THaystacks> > & finder_sequence_id,
 			std::vector< unsigned > & possible_sids,
+			CharString & sequence_id_in_read1,
 			bool const & align_null,
 			bool & verbose,
 			unsigned & nullLigation );
@@ -84,23 +534,51 @@ find_possible_sids( std::vector< unsigned > & possible_sids,
 		    Finder<Index<THaystacks> > & finder_sequence_id,
 		    CharString & sequence_id_region_in_sequence1 );
 
+void
+find_possible_sids( std::vector< unsigned > & possible_sids,
+		    std::vector< unsigned > & possible_begpos,
+		    SequenceIdTable const & sequence_id_table,
+		    CharString const & sequence_id_region_in_sequence1 );
+
+void
+find_possible_sids_in_variants( std::vector< unsigned > & possible_sids,
+		    std::vector< unsigned > & possible_begpos,
+		    SequenceIdTable const & sequence_id_table,
+		    CharString const & sequence_id_region_in_sequence1 );
+
+void
+setup_sequence_id_table( SequenceIdTable & sequence_id_table,
+			 std::vector< CharString > const & RNA_sequences,
+			 CharString const & cseq,
+			 unsigned const seqid_length,
+			 Index<THaystacks> & index_sequence_id,
+			 bool const match_single_nt_variants );
+
+void
+setup_reference_arena( ReferenceArena & arena, AlignmentSetup & setup );
+
+bool
+pack_sequence_id_window( CharString const & seq, unsigned const seqid_length, __uint64 & key );
+
+void
+setup_star_anchors( String< CharString > & star_anchors,
+		    std::vector< unsigned > & star_anchor_idx,
+		    std::vector< CharString > const & sequences_before_star );
+
 void
 check_for_extra_junk_using_star_sequences(
 					  std::vector< unsigned > & possible_sids,
 					  std::vector< CharString > & sequences_with_extra_junk,
 					  bool & extra_junk_mode,
-					  Finder<Index<THaystacks> > & finder_sequence_id,
+					  TStarAnchorPattern & star_anchor_pattern,
+					  std::vector< unsigned > const & star_anchor_idx,
+					  std::vector< int > & star_anchor_end_pos,
 					  CharString & seq1,
 					  unsigned const & constant_sequence_begin_pos,
 					  std::vector< CharString > const & sequences_before_star,
 					  std::vector< CharString > const & sequences_after_star,
 					  std::vector< unsigned > const & star_sequence_ids );
 
-void
-output_stats_files( std::vector< std::vector< std::vector < double > > > const & all_count,
-		    std::string const & outpath,
-		    std::string const file_prefix );
-
 bool
 already_saved( std::vector< unsigned > const & mpos_vector,
 	       std::vector< unsigned > const & sid_vector,
@@ -0,0 +1,263 @@
+#ifndef MAPSEEKER_BGZF_H
+#define MAPSEEKER_BGZF_H
+
+#include <fstream>
+#include <seqan/sequence.h>
+#include <seqan/stream.h>
+#include <seqan/parallel.h>
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// Fastq files straight from the sequencer are gzipped. If they were compressed with bgzip (BGZF format),
+// they are a series of independent gzip blocks of <= 64 kB each, and we can inflate many blocks at once on
+// several threads. [seqan's Stream<Bgzf> only inflates one block at a time.]
+//
+// ParallelBgzfReader only supports what RecordReader<TStream, SinglePass<> > needs: streamReadBlock,
+// streamEof, streamError, streamTell.
+////////////////////////////////////////////////////////////////
+
+// how many blocks each thread inflates per refill.
+unsigned const bgzf_blocks_per_thread( 16 );
+
+bool
+is_gz_file( std::string const & filename );
+
+bool
+is_bgzf_file( std::string const & filename );
+
+#if SEQAN_HAS_ZLIB
+
+struct ParallelBgzfReader {
+	ParallelBgzfReader();
+
+	std::ifstream file;
+	unsigned num_threads;
+
+	std::vector< String<char> > compressed_blocks, uncompressed_blocks;
+	std::vector< int > uncompressed_lengths;
+	unsigned num_blocks, current_block, current_offset;
+
+	__int64 position; // in uncompressed data.
+	bool file_done;
+	int error;
+};
+
+namespace seqan {
+template <>
+struct Position< ParallelBgzfReader >
+{
+	typedef __int64 Type;
+};
+}
+
+bool
+open( ParallelBgzfReader & reader, std::string const & filename, unsigned const num_threads );
+
+bool
+refill_bgzf_blocks( ParallelBgzfReader & reader );
+
+int
+inflate_bgzf_block( String<char> & compressed_block, String<char> & uncompressed_block );
+
+size_t
+streamReadBlock( char * target, ParallelBgzfReader & reader, size_t maxLen );
+
+bool
+streamEof( ParallelBgzfReader & reader );
+
+int
+streamError( ParallelBgzfReader & reader );
+
+__int64
+streamTell( ParallelBgzfReader & reader );
+
+#endif  // #if SEQAN_HAS_ZLIB
+
+////////////////////////////////////////////////////////////////
+// gzip files start with the magic bytes 1f 8b.
+inline
+bool
+is_gz_file( std::string const & filename ){
+	std::ifstream file( filename.c_str(), std::ios_base::in | std::ios_base::binary );
+	unsigned char magic[ 2 ];
+	if ( !file.read( (char *) magic, 2 ) ) return false;
+	return ( magic[0] == 0x1f && magic[1] == 0x8b );
+}
+
+////////////////////////////////////////////////////////////////
+// BGZF files are gzip files whose first block carries the 'BC' extra field.
+inline
+bool
+is_bgzf_file( std::string const & filename ){
+#if SEQAN_HAS_ZLIB
+	std::ifstream file( filename.c_str(), std::ios_base::in | std::ios_base::binary );
+	char header[ 18 ];
+	if ( !file.read( header, 18 ) ) return false;
+	return _bgzfCheckHeader( header );
+#else
+	(void) filename;
+	return false;
+#endif
+}
+
+#if SEQAN_HAS_ZLIB
+
+////////////////////////////////////////////////////////////////
+inline
+ParallelBgzfReader::ParallelBgzfReader():
+	num_threads( 1 ),
+	num_blocks( 0 ),
+	current_block( 0 ),
+	current_offset( 0 ),
+	position( 0 ),
+	file_done( false ),
+	error( 0 )
+{}
+
+////////////////////////////////////////////////////////////////
+inline
+bool
+open( ParallelBgzfReader & reader, std::string const & filename, unsigned const num_threads ){
+	reader.file.open( filename.c_str(), std::ios_base::in | std::ios_base::binary );
+	if ( !reader.file.good() ) return false;
+
+	reader.num_threads = ( num_threads > 0 ) ? num_threads : 1;
+	unsigned const max_blocks = bgzf_blocks_per_thread * reader.num_threads;
+	reader.compressed_blocks.resize( max_blocks );
+	reader.uncompressed_blocks.resize( max_blocks );
+	reader.uncompressed_lengths.resize( max_blocks, 0 );
+
+#ifdef _OPENMP
+	// blocks get inflated while the other alignment threads keep going, so we need a nested thread team.
+	if ( reader.num_threads > 1 ) omp_set_nested( 1 );
+#endif
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// Read in the next bunch of compressed blocks from disk, and then inflate them all at once.
+// Returns false if there is nothing left to read.
+inline
+bool
+refill_bgzf_blocks( ParallelBgzfReader & reader ){
+
+	int const BLOCK_HEADER_LENGTH = 18;
+	reader.num_blocks = 0;
+	reader.current_block = 0;
+	reader.current_offset = 0;
+	if ( reader.file_done || reader.error ) return false;
+
+	while ( reader.num_blocks < reader.compressed_blocks.size() ){
+		String<char> & compressed_block = reader.compressed_blocks[ reader.num_blocks ];
+		resize( compressed_block, BLOCK_HEADER_LENGTH );
+		if ( !reader.file.read( &compressed_block[0], BLOCK_HEADER_LENGTH ) ) {
+			if ( reader.file.gcount() != 0 ) reader.error = 1; // truncated header.
+			reader.file_done = true;
+			break;
+		}
+		if ( !_bgzfCheckHeader( &compressed_block[0] ) ) {
+			std::cerr << "ERROR! Not a BGZF block in gzipped fastq file." << std::endl;
+			reader.error = 1;
+			break;
+		}
+		int const block_length = _bgzfUnpackInt16( (unsigned char *) &compressed_block[16] ) + 1;
+		resize( compressed_block, block_length );
+		if ( !reader.file.read( &compressed_block[ BLOCK_HEADER_LENGTH ], block_length - BLOCK_HEADER_LENGTH ) ) {
+			reader.error = 1; // truncated block.
+			break;
+		}
+		reader.num_blocks++;
+	}
+
+	int const num_blocks = reader.num_blocks;
+	bool inflate_error( false );
+	SEQAN_OMP_PRAGMA( parallel for num_threads( reader.num_threads ) schedule( dynamic ) )
+	for ( int n = 0; n < num_blocks; n++ ){
+		reader.uncompressed_lengths[ n ] = inflate_bgzf_block( reader.compressed_blocks[ n ], reader.uncompressed_blocks[ n ] );
+		if ( reader.uncompressed_lengths[ n ] < 0 ) inflate_error = true;
+	}
+	if ( inflate_error ) {
+		std::cerr << "ERROR! Could not decompress block in gzipped fastq file." << std::endl;
+		reader.error = 1;
+		reader.num_blocks = 0;
+	}
+
+	return ( reader.num_blocks > 0 );
+}
+
+////////////////////////////////////////////////////////////////
+// Returns the number of uncompressed bytes, or -1 if the block is corrupt.
+inline
+int
+inflate_bgzf_block( String<char> & compressed_block, String<char> & uncompressed_block ){
+
+	int const BLOCK_HEADER_LENGTH = 18;
+	int const MAX_BLOCK_SIZE = 64 * 1024;
+	int const GZIP_WINDOW_BITS = -15; // no zlib header
+	resize( uncompressed_block, MAX_BLOCK_SIZE );
+
+	z_stream zs;
+	zs.zalloc = NULL;
+	zs.zfree = NULL;
+	zs.next_in = (Bytef *) &compressed_block[0] + BLOCK_HEADER_LENGTH;
+	zs.avail_in = length( compressed_block ) - BLOCK_HEADER_LENGTH;
+	zs.next_out = (Bytef *) &uncompressed_block[0];
+	zs.avail_out = MAX_BLOCK_SIZE;
+
+	if ( inflateInit2( &zs, GZIP_WINDOW_BITS ) != Z_OK ) return -1;
+	if ( inflate( &zs, Z_FINISH ) != Z_STREAM_END ) {
+		inflateEnd( &zs );
+		return -1;
+	}
+	if ( inflateEnd( &zs ) != Z_OK ) return -1;
+	return zs.total_out;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+size_t
+streamReadBlock( char * target, ParallelBgzfReader & reader, size_t maxLen ){
+	size_t num_read( 0 );
+	while ( num_read < maxLen ){
+		if ( reader.current_block >= reader.num_blocks && !refill_bgzf_blocks( reader ) ) break;
+
+		int const block_length = reader.uncompressed_lengths[ reader.current_block ];
+		size_t const num_to_copy = std::min( maxLen - num_read, size_t( block_length - reader.current_offset ) );
+		if ( num_to_copy > 0 ) memcpy( target + num_read, &reader.uncompressed_blocks[ reader.current_block ][ reader.current_offset ], num_to_copy );
+		num_read += num_to_copy;
+		reader.current_offset += num_to_copy;
+
+		if ( int( reader.current_offset ) >= block_length ){
+			reader.current_block++;
+			reader.current_offset = 0;
+		}
+	}
+	reader.position += num_read;
+	return num_read;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+bool
+streamEof( ParallelBgzfReader & reader ){
+	return ( reader.current_block >= reader.num_blocks && ( reader.file_done || reader.error ) );
+}
+
+////////////////////////////////////////////////////////////////
+inline
+int
+streamError( ParallelBgzfReader & reader ){
+	return reader.error;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+__int64
+streamTell( ParallelBgzfReader & reader ){
+	return reader.position;
+}
+
+#endif  // #if SEQAN_HAS_ZLIB
+
+#endif
@@ -0,0 +1,78 @@
+// -*- mode:c++;tab-width:2;indent-tabs-mode:t;show-trailing-whitespace:t;rm-trailing-spaces:t -*-
+// vi: set ts=2 noet:
+// :noTabs=false:tabSize=4:indentSize=4:
+//
+// (c) Copyright Laboratory of Rhiju Das, Stanford University.
+
+// Converts a binary count file from MAPseeker --binary_output [stats.bin] to the classic text files
+// stats_ID1.txt, stats_ID2.txt, ... [or to stats_ID*.sparse.txt, or to another binary file].
+
+#define SEQAN_PROFILE // enable time measurements
+
+#include <apps/MAPseeker_count_file.h>
+#include <seqan/misc/misc_cmdparser.h>
+
+//Versioning information
+inline void
+_addVersion(CommandLineParser& parser) {
+	addVersionLine(parser, "Version 1.0");
+}
+
+int main(int argc, const char *argv[]) {
+
+	CommandLineParser parser;
+	_addVersion(parser);
+
+	addTitleLine(parser, "                                                 ");
+	addTitleLine(parser, "*************************************************");
+	addTitleLine(parser, "* MAP-Seeker count file converter               *");
+	addTitleLine(parser, "* (c) Copyright 2013, R. Das                    *");
+	addTitleLine(parser, "*************************************************");
+	addTitleLine(parser, "                                                 ");
+
+	addUsageLine(parser, " -i <stats.bin> [-O <out path>]");
+
+	addSection(parser, "Main Options:");
+	addOption(parser, addArgumentText(CommandLineOption("i", "input", "binary count file from MAPseeker --binary_output", OptionType::String), "<BINARY FILE>"));
+	addOption(parser, addArgumentText(CommandLineOption("O", "outpath", "output path for stats files", OptionType::String, ""), "<out path>"));
+	addOption(parser, addArgumentText(CommandLineOption("f", "file_prefix", "prefix of output files, e.g. stats or strict_stats", OptionType::String, "stats"), "<prefix>"));
+	addOption(parser, addArgumentText(CommandLineOption("P", "sparse_output", "output only nonzero counts [stats_ID*.sparse.txt]", OptionType::Bool, false), ""));
+	addOption(parser, addArgumentText(CommandLineOption("B", "binary_output", "write another binary file instead of text [e.g. to compress it]", OptionType::String, ""), "<BINARY FILE>"));
+	addOption(parser, addArgumentText(CommandLineOption("Z", "compress_output", "compress the binary output file with zlib", OptionType::Bool, false), ""));
+
+	if (argc == 1) {
+		shortHelp(parser, std::cerr);	// print short help and exit
+		return 0;
+	}
+
+	if (!parse(parser, argc, argv, std::cerr)) exit( 0 );
+	if (isSetLong(parser, "help") || isSetLong(parser, "version")) return 0;	// print help or version and exit
+
+	SEQAN_PROTIMESTART(loadTime);
+	std::string file_input, outpath, file_prefix( "stats" ), file_binary_output;
+	getOptionValueLong(parser, "input",file_input);
+	getOptionValueLong(parser, "outpath",outpath);
+	if ( outpath.size() > 0 && outpath[ outpath.size()-1 ] != '/' ) outpath += '/';
+	getOptionValueLong(parser, "file_prefix",file_prefix);
+	getOptionValueLong(parser, "binary_output",file_binary_output);
+	bool sparse_output = isSetLong( parser, "sparse_output" );
+	bool compress_output = isSetLong( parser, "compress_output" );
+	if ( file_binary_output.size() == 0 && !make_output_dir( outpath ) ) exit( 0 );
+
+	CountFile count_file;
+	CountTensor all_count;
+	if ( !open_count_file( count_file, file_input ) ) exit( 0 );
+	if ( !load_count_file( count_file, all_count ) ) exit( 0 );
+	std::cout << "Read " << all_count.num_expt_ids << " experimental IDs x " << all_count.num_sequences << " sequences x " << all_count.num_positions << " positions from " << file_input << " in " << SEQAN_PROTIMEDIFF(loadTime) << " seconds." << std::endl;
+
+	if ( file_binary_output.size() > 0 ) {
+		std::cout << "Outputting counts to: " << file_binary_output << std::endl;
+		if ( !write_count_file( all_count, count_file.expt_id_names, count_file.sequence_names, file_binary_output, compress_output ) ) exit( 0 );
+	} else if ( sparse_output ) {
+		output_sparse_stats_files( all_count, outpath, file_prefix );
+	} else {
+		output_stats_files( all_count, outpath, file_prefix );
+	}
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+#ifndef MAPSEEKER_COUNT_FILE_H
+#define MAPSEEKER_COUNT_FILE_H
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/file.h>
+#include <apps/MAPseeker_counts.h>
+#if SEQAN_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// Binary count file [e.g. stats.bin] -- all experimental IDs in one file, instead of one text file of
+// " %10.3f" cells per experimental ID. Layout, in native (little-endian) byte order:
+//
+//   CountFileHeader [64 bytes]
+//   names           -- expt ID names, then sequence names, each followed by '\n'.
+//   counts          -- at data_offset [a multiple of 8]. For each experimental ID, the
+//                      num_sequences x num_positions values of a dense CountTensor, position fastest.
+//                      With COUNT_FILE_COMPRESSED, each experimental ID's block is instead deflated
+//                      with zlib: num_expt_ids 64-bit compressed lengths, then the compressed blocks.
+//
+// Uncompressed files can be memory-mapped, and then the counts used in place (count_file_values).
+// MAPseeker_convert turns count files back into stats_ID*.txt.
+////////////////////////////////////////////////////////////////
+
+char const count_file_magic[ 8 ] = { 'M', 'A', 'P', 'S', 'E', 'E', 'K', 'C' };
+__uint32 const count_file_version( 1 );
+__uint32 const COUNT_FILE_COMPRESSED( 1 );
+
+struct CountFileHeader {
+	char magic[ 8 ];
+	__uint32 version, count_type, flags;
+	__uint32 num_expt_ids, num_sequences, num_positions;
+	__uint64 names_offset, names_length;
+	__uint64 data_offset, data_length;
+};
+
+typedef String<char, MMap<> > TCountFileMMap;
+
+struct CountFile {
+	TCountFileMMap mapping;
+	CountFileHeader header;
+	std::vector< std::string > expt_id_names, sequence_names;
+};
+
+size_t
+count_value_size( CountType const count_type );
+
+void
+get_dense_count_block( CountTensor const & counts, unsigned const expt_idx, std::vector< char > & block );
+
+bool
+write_count_file( CountTensor const & counts,
+									std::vector< std::string > const & expt_id_names,
+									std::vector< std::string > const & sequence_names,
+									std::string const & filename,
+									bool const compress );
+
+bool
+open_count_file( CountFile & count_file, std::string const & filename );
+
+char const *
+count_file_values( CountFile & count_file, unsigned const expt_idx );
+
+bool
+load_count_file( CountFile & count_file, CountTensor & counts );
+
+////////////////////////////////////////////////////////////////
+inline
+size_t
+count_value_size( CountType const count_type ){
+	return ( count_type == FLOAT_COUNTS ) ? sizeof( float ) : sizeof( double );
+}
+
+////////////////////////////////////////////////////////////////
+// the raw values for one experimental ID, dense, whatever the storage of the tensor.
+inline
+void
+get_dense_count_block( CountTensor const & counts, unsigned const expt_idx, std::vector< char > & block ){
+
+	size_t const value_size = count_value_size( counts.count_type );
+	size_t const cells_per_expt_id = size_t( counts.num_sequences ) * counts.num_positions;
+	block.assign( cells_per_expt_id * value_size, 0 );
+	if ( cells_per_expt_id == 0 ) return;
+
+	if ( !counts.sparse ) {
+		size_t const first_cell = expt_idx * cells_per_expt_id;
+		switch ( counts.count_type ){
+		case DOUBLE_COUNTS:      memcpy( &block[0], &counts.double_counts[ first_cell ], block.size() ); break;
+		case FLOAT_COUNTS:       memcpy( &block[0], &counts.float_counts[ first_cell ], block.size() ); break;
+		case FIXED_POINT_COUNTS: memcpy( &block[0], &counts.fixed_point_counts[ first_cell ], block.size() ); break;
+		}
+		return;
+	}
+
+	for ( size_t m = 0; m < counts.sparse_cells.size(); m++ ){
+		if ( counts.sparse_cells[ m ] == 0 ) continue;
+		size_t const cell = counts.sparse_cells[ m ] - 1;
+		if ( cell / cells_per_expt_id != expt_idx ) continue;
+		char * target = &block[ ( cell % cells_per_expt_id ) * value_size ];
+		switch ( counts.count_type ){
+		case DOUBLE_COUNTS:      memcpy( target, &counts.double_counts[ m ], value_size ); break;
+		case FLOAT_COUNTS:       memcpy( target, &counts.float_counts[ m ], value_size ); break;
+		case FIXED_POINT_COUNTS: memcpy( target, &counts.fixed_point_counts[ m ], value_size ); break;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+bool
+write_count_file( CountTensor const & counts,
+									std::vector< std::string > const & expt_id_names,
+									std::vector< std::string > const & sequence_names,
+									std::string const & filename,
+									bool const compress ){
+
+#if !SEQAN_HAS_ZLIB
+	if ( compress ) { std::cerr << "ERROR! Compiled without zlib, so cannot compress count file." << std::endl; return false; }
+#endif
+	SEQAN_ASSERT_EQ( expt_id_names.size(), counts.num_expt_ids );
+	SEQAN_ASSERT_EQ( sequence_names.size(), counts.num_sequences );
+
+	std::string names;
+	for ( unsigned i = 0; i < expt_id_names.size(); i++ ) names += expt_id_names[ i ] + '\n';
+	for ( unsigned j = 0; j < sequence_names.size(); j++ ) names += sequence_names[ j ] + '\n';
+
+	CountFileHeader header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, count_file_magic, sizeof( header.magic ) );
+	header.version = count_file_version;
+	header.count_type = counts.count_type;
+	header.flags = compress ? COUNT_FILE_COMPRESSED : 0;
+	header.num_expt_ids = counts.num_expt_ids;
+	header.num_sequences = counts.num_sequences;
+	header.num_positions = counts.num_positions;
+	header.names_offset = sizeof( header );
+	header.names_length = names.size();
+	header.data_offset = ( header.names_offset + header.names_length + 7 ) / 8 * 8;
+
+	FILE * oFile = fopen( filename.c_str(), "wb" );
+	if ( oFile == 0 ) { std::cerr << "Problem with file: " << filename << std::endl; return false; }
+
+	// header gets written again at the end, once data_length is known.
+	fwrite( &header, sizeof( header ), 1, oFile );
+	fwrite( names.data(), 1, names.size(), oFile );
+	char const padding[ 8 ] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	fwrite( padding, 1, header.data_offset - header.names_offset - header.names_length, oFile );
+
+	std::vector< __uint64 > compressed_lengths( counts.num_expt_ids, 0 );
+	if ( compress ) fwrite( &compressed_lengths[0], sizeof( __uint64 ), compressed_lengths.size(), oFile );
+
+	std::vector< char > block;
+	for ( unsigned i = 0; i < counts.num_expt_ids; i++ ){
+		get_dense_count_block( counts, i, block );
+		if ( block.size() == 0 ) continue;
+		if ( !compress ) {
+			fwrite( &block[0], 1, block.size(), oFile );
+			header.data_length += block.size();
+			continue;
+		}
+#if SEQAN_HAS_ZLIB
+		uLongf compressed_length = compressBound( block.size() );
+		std::vector< char > compressed_block( compressed_length );
+		if ( compress2( (Bytef *) &compressed_block[0], &compressed_length, (Bytef const *) &block[0], block.size(), Z_DEFAULT_COMPRESSION ) != Z_OK ) {
+			std::cerr << "ERROR! Could not compress counts for " << filename << std::endl; fclose( oFile ); return false;
+		}
+		fwrite( &compressed_block[0], 1, compressed_length, oFile );
+		compressed_lengths[ i ] = compressed_length;
+		header.data_length += compressed_length;
+#endif
+	}
+	if ( compress ) {
+		header.data_length += compressed_lengths.size() * sizeof( __uint64 );
+		fseek( oFile, header.data_offset, SEEK_SET );
+		fwrite( &compressed_lengths[0], sizeof( __uint64 ), compressed_lengths.size(), oFile );
+	}
+
+	fseek( oFile, 0, SEEK_SET );
+	fwrite( &header, sizeof( header ), 1, oFile );
+	bool const ok = !ferror( oFile );
+	fclose( oFile );
+	if ( !ok ) std::cerr << "ERROR! Problem writing " << filename << std::endl;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////
+// maps the file into memory, and checks the header and names.
+inline
+bool
+open_count_file( CountFile & count_file, std::string const & filename ){
+
+	if ( !open( count_file.mapping, filename.c_str(), OPEN_RDONLY ) ) { std::cerr << "Problem with file: " << filename << std::endl; return false; }
+	if ( length( count_file.mapping ) < sizeof( CountFileHeader ) ) { std::cerr << "ERROR! Not a MAPseeker count file: " << filename << std::endl; return false; }
+
+	CountFileHeader & header = count_file.header;
+	memcpy( &header, &count_file.mapping[0], sizeof( header ) );
+	if ( memcmp( header.magic, count_file_magic, sizeof( header.magic ) ) != 0 ) { std::cerr << "ERROR! Not a MAPseeker count file: " << filename << std::endl; return false; }
+	if ( header.version != count_file_version ) { std::cerr << "ERROR! Count file version " << header.version << " not supported: " << filename << std::endl; return false; }
+	if ( header.count_type > FIXED_POINT_COUNTS ) { std::cerr << "ERROR! Unknown count type in " << filename << std::endl; return false; }
+#if !SEQAN_HAS_ZLIB
+	if ( header.flags & COUNT_FILE_COMPRESSED ) { std::cerr << "ERROR! Compiled without zlib, so cannot read compressed count file: " << filename << std::endl; return false; }
+#endif
+
+	__uint64 const dense_length = __uint64( header.num_expt_ids ) * header.num_sequences * header.num_positions * count_value_size( CountType( header.count_type ) );
+	if ( header.names_offset + header.names_length > length( count_file.mapping ) ||
+			 header.data_offset + header.data_length > length( count_file.mapping ) ||
+			 ( !( header.flags & COUNT_FILE_COMPRESSED ) && header.data_length != dense_length ) ||
+			 ( ( header.flags & COUNT_FILE_COMPRESSED ) && header.data_length < header.num_expt_ids * sizeof( __uint64 ) ) ) {
+		std::cerr << "ERROR! Truncated count file: " << filename << std::endl; return false;
+	}
+
+	count_file.expt_id_names.clear();
+	count_file.sequence_names.clear();
+	char const * names = &count_file.mapping[0] + header.names_offset;
+	size_t name_begin = 0;
+	for ( size_t n = 0; n < header.names_length; n++ ){
+		if ( names[ n ] != '\n' ) continue;
+		std::string const name( names + name_begin, n - name_begin );
+		if ( count_file.expt_id_names.size() < header.num_expt_ids ) count_file.expt_id_names.push_back( name );
+		else count_file.sequence_names.push_back( name );
+		name_begin = n + 1;
+	}
+	if ( count_file.expt_id_names.size() != header.num_expt_ids || count_file.sequence_names.size() != header.num_sequences ) {
+		std::cerr << "ERROR! Names do not match dimensions in count file: " << filename << std::endl; return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// counts for one experimental ID, in place in the mapping -- only for uncompressed files.
+inline
+char const *
+count_file_values( CountFile & count_file, unsigned const expt_idx ){
+	SEQAN_ASSERT( !( count_file.header.flags & COUNT_FILE_COMPRESSED ) );
+	size_t const block_length = size_t( count_file.header.num_sequences ) * count_file.header.num_positions * count_value_size( CountType( count_file.header.count_type ) );
+	return &count_file.mapping[0] + count_file.header.data_offset + expt_idx * block_length;
+}
+
+////////////////////////////////////////////////////////////////
+// copies (or inflates) the counts into a dense CountTensor.
+inline
+bool
+load_count_file( CountFile & count_file, CountTensor & counts ){
+
+	CountFileHeader const & header = count_file.header;
+	resize_counts( counts, CountType( header.count_type ), DENSE_COUNT_STORAGE, header.num_expt_ids, header.num_sequences, header.num_positions );
+
+	size_t const block_length = size_t( header.num_sequences ) * header.num_positions * count_value_size( counts.count_type );
+	char const * compressed_block = &count_file.mapping[0] + header.data_offset + header.num_expt_ids * sizeof( __uint64 );
+	for ( unsigned i = 0; i < header.num_expt_ids; i++ ){
+		if ( block_length == 0 ) break;
+		char * target( 0 );
+		switch ( counts.count_type ){
+		case DOUBLE_COUNTS:      target = (char *) &counts.double_counts[ i * block_length / sizeof( double ) ]; break;
+		case FLOAT_COUNTS:       target = (char *) &counts.float_counts[ i * block_length / sizeof( float ) ]; break;
+		case FIXED_POINT_COUNTS: target = (char *) &counts.fixed_point_counts[ i * block_length / sizeof( __uint64 ) ]; break;
+		}
+		if ( !( header.flags & COUNT_FILE_COMPRESSED ) ) {
+			memcpy( target, count_file_values( count_file, i ), block_length );
+			continue;
+		}
+#if SEQAN_HAS_ZLIB
+		__uint64 compressed_length;
+		memcpy( &compressed_length, &count_file.mapping[0] + header.data_offset + i * sizeof( __uint64 ), sizeof( __uint64 ) );
+		if ( compressed_block + compressed_length > &count_file.mapping[0] + header.data_offset + header.data_length ) {
+			std::cerr << "ERROR! Truncated count file." << std::endl; return false;
+		}
+		uLongf uncompressed_length = block_length;
+		if ( uncompress( (Bytef *) target, &uncompressed_length, (Bytef const *) compressed_block, compressed_length ) != Z_OK ||
+				 uncompressed_length != block_length ) {
+			std::cerr << "ERROR! Could not decompress count file." << std::endl; return false;
+		}
+		compressed_block += compressed_length;
+#endif
+	}
+	return true;
+}
+
+#endif
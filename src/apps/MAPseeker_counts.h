@@ -0,0 +1,510 @@
+#ifndef MAPSEEKER_COUNTS_H
+#define MAPSEEKER_COUNTS_H
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <seqan/basic.h>
+#include <sys/stat.h>
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// Counts of RT stops, for each experimental ID, sequence ID, and position [0 ... max_rna_len].
+//
+// Dense counts sit in one contiguous buffer, with position varying fastest and then sequence ID -- a row
+// for one (expt, sid) is what output_stats_files() writes out as one line. Each read pair adds 1/n to
+// each of its n possible placements, so the value type can be:
+//
+//   double      -- the classic counts.
+//   float       -- half the memory, good to ~7 significant digits.
+//   fixed       -- 64-bit integer multiples of 1/720720 [= lcm(1,...,16)], so weights 1/n are exact for
+//                  n <= 16, and sums do not depend on the order reads (or threads) came in.
+//
+// Only the buffer for the chosen value type gets allocated.
+//
+// For big libraries (thousands of designs) almost every cell stays zero, so counts can instead be sparse:
+// the same value buffer then holds the values of an open-addressing hash table, and sparse_cells holds
+// the matching keys [cell index + 1; 0 marks an empty slot]. With AUTO_COUNT_STORAGE, big tensors start
+// out sparse, and turn dense once the hash table would take more memory than the dense buffer.
+////////////////////////////////////////////////////////////////
+
+enum CountType { DOUBLE_COUNTS, FLOAT_COUNTS, FIXED_POINT_COUNTS };
+enum CountStorage { AUTO_COUNT_STORAGE, DENSE_COUNT_STORAGE, SPARSE_COUNT_STORAGE };
+
+__uint64 const fixed_point_count_scale( 720720 );
+
+// AUTO_COUNT_STORAGE keeps tensors with fewer cells than this dense from the start.
+size_t const sparse_count_min_cells( 1 << 24 );
+size_t const sparse_count_initial_slots( 1 << 10 );
+
+struct CountTensor {
+	CountTensor();
+
+	CountType count_type;
+	bool sparse;
+	unsigned num_expt_ids, num_sequences, num_positions;
+
+	std::vector< double > double_counts;
+	std::vector< float > float_counts;
+	std::vector< __uint64 > fixed_point_counts;
+
+	std::vector< __uint64 > sparse_cells;
+	size_t num_sparse_cells;
+};
+
+bool
+get_count_type( std::string const & count_type_name, CountType & count_type );
+
+bool
+get_count_storage( std::string const & count_storage_name, CountStorage & count_storage );
+
+void
+resize_counts( CountTensor & counts,
+							 CountType const count_type,
+							 CountStorage const count_storage,
+							 unsigned const num_expt_ids,
+							 unsigned const num_sequences,
+							 unsigned const num_positions );
+
+void
+allocate_count_values( CountTensor & counts, size_t const num_slots );
+
+size_t
+num_count_cells( CountTensor const & counts );
+
+size_t
+count_index( CountTensor const & counts, unsigned const expt_idx, unsigned const sid_idx, unsigned const pos );
+
+size_t
+sparse_count_slot( CountTensor const & counts, size_t const cell );
+
+size_t
+find_count_slot( CountTensor const & counts, size_t const cell );
+
+size_t
+insert_count_slot( CountTensor & counts, size_t const cell );
+
+void
+grow_sparse_counts( CountTensor & counts );
+
+void
+add_count_slot( CountTensor & counts, size_t const n, CountTensor const & other_counts, size_t const m );
+
+void
+add_count( CountTensor & counts, unsigned const expt_idx, unsigned const sid_idx, unsigned const pos, float const weight, unsigned const multiplicity = 1 );
+
+double
+get_count_in_slot( CountTensor const & counts, size_t const n );
+
+double
+get_count( CountTensor const & counts, unsigned const expt_idx, unsigned const sid_idx, unsigned const pos );
+
+void
+get_nonzero_cells( CountTensor const & counts, std::vector< size_t > & cells, std::vector< size_t > & slots );
+
+void
+merge_counts( CountTensor & counts, CountTensor const & other_counts );
+
+bool
+make_output_dir( std::string const & outpath );
+
+void
+output_stats_files( CountTensor const & all_count,
+		    std::string const & outpath,
+		    std::string const file_prefix );
+
+void
+output_sparse_stats_files( CountTensor const & all_count,
+			   std::string const & outpath,
+			   std::string const file_prefix );
+
+////////////////////////////////////////////////////////////////
+inline
+CountTensor::CountTensor():
+	count_type( DOUBLE_COUNTS ),
+	sparse( false ),
+	num_expt_ids( 0 ),
+	num_sequences( 0 ),
+	num_positions( 0 ),
+	num_sparse_cells( 0 )
+{}
+
+////////////////////////////////////////////////////////////////
+// --count_type on the command line.
+inline
+bool
+get_count_type( std::string const & count_type_name, CountType & count_type ){
+	if ( count_type_name == "double" ) { count_type = DOUBLE_COUNTS; return true; }
+	if ( count_type_name == "float" ) { count_type = FLOAT_COUNTS; return true; }
+	if ( count_type_name == "fixed" ) { count_type = FIXED_POINT_COUNTS; return true; }
+	return false;
+}
+
+////////////////////////////////////////////////////////////////
+// --count_storage on the command line.
+inline
+bool
+get_count_storage( std::string const & count_storage_name, CountStorage & count_storage ){
+	if ( count_storage_name == "auto" ) { count_storage = AUTO_COUNT_STORAGE; return true; }
+	if ( count_storage_name == "dense" ) { count_storage = DENSE_COUNT_STORAGE; return true; }
+	if ( count_storage_name == "sparse" ) { count_storage = SPARSE_COUNT_STORAGE; return true; }
+	return false;
+}
+
+////////////////////////////////////////////////////////////////
+// Allocates and zeroes the counts.
+inline
+void
+resize_counts( CountTensor & counts,
+							 CountType const count_type,
+							 CountStorage const count_storage,
+							 unsigned const num_expt_ids,
+							 unsigned const num_sequences,
+							 unsigned const num_positions ){
+
+	counts.count_type = count_type;
+	counts.num_expt_ids = num_expt_ids;
+	counts.num_sequences = num_sequences;
+	counts.num_positions = num_positions;
+
+	size_t const num_cells = num_count_cells( counts );
+	counts.sparse = ( count_storage == SPARSE_COUNT_STORAGE ||
+										( count_storage == AUTO_COUNT_STORAGE && num_cells >= sparse_count_min_cells ) );
+	counts.num_sparse_cells = 0;
+	if ( counts.sparse ) {
+		counts.sparse_cells.assign( sparse_count_initial_slots, 0 );
+		allocate_count_values( counts, sparse_count_initial_slots );
+	} else {
+		std::vector< __uint64 >().swap( counts.sparse_cells );
+		allocate_count_values( counts, num_cells );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// zeroed buffer of values for the tensor's value type; the others get freed.
+inline
+void
+allocate_count_values( CountTensor & counts, size_t const num_slots ){
+	std::vector< double >().swap( counts.double_counts );
+	std::vector< float >().swap( counts.float_counts );
+	std::vector< __uint64 >().swap( counts.fixed_point_counts );
+	switch ( counts.count_type ){
+	case DOUBLE_COUNTS:      counts.double_counts.resize( num_slots, 0.0 ); break;
+	case FLOAT_COUNTS:       counts.float_counts.resize( num_slots, 0.0 ); break;
+	case FIXED_POINT_COUNTS: counts.fixed_point_counts.resize( num_slots, 0 ); break;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+size_t
+num_count_cells( CountTensor const & counts ){
+	return size_t( counts.num_expt_ids ) * counts.num_sequences * counts.num_positions;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+size_t
+count_index( CountTensor const & counts, unsigned const expt_idx, unsigned const sid_idx, unsigned const pos ){
+	return ( size_t( expt_idx ) * counts.num_sequences + sid_idx ) * counts.num_positions + pos;
+}
+
+////////////////////////////////////////////////////////////////
+// where to start probing for a cell in the sparse hash table [Fibonacci hashing; table size is a power of 2].
+inline
+size_t
+sparse_count_slot( CountTensor const & counts, size_t const cell ){
+	return size_t( ( __uint64( cell ) * 0x9E3779B97F4A7C15ULL ) >> 20 ) & ( counts.sparse_cells.size() - 1 );
+}
+
+////////////////////////////////////////////////////////////////
+// slot holding a cell in the sparse hash table, or size_t(-1) if the cell is still zero.
+inline
+size_t
+find_count_slot( CountTensor const & counts, size_t const cell ){
+	size_t const mask = counts.sparse_cells.size() - 1;
+	for ( size_t n = sparse_count_slot( counts, cell ); counts.sparse_cells[ n ] != 0; n = ( n + 1 ) & mask ){
+		if ( counts.sparse_cells[ n ] == cell + 1 ) return n;
+	}
+	return size_t( -1 );
+}
+
+////////////////////////////////////////////////////////////////
+// slot to add a cell's counts into -- may grow the hash table, or switch the counts over to dense.
+inline
+size_t
+insert_count_slot( CountTensor & counts, size_t const cell ){
+	size_t n = find_count_slot( counts, cell );
+	if ( n != size_t( -1 ) ) return n;
+
+	if ( 2 * ( counts.num_sparse_cells + 1 ) > counts.sparse_cells.size() ) {
+		grow_sparse_counts( counts );
+		if ( !counts.sparse ) return cell;
+	}
+	size_t const mask = counts.sparse_cells.size() - 1;
+	for ( n = sparse_count_slot( counts, cell ); counts.sparse_cells[ n ] != 0; n = ( n + 1 ) & mask ) {}
+	counts.sparse_cells[ n ] = cell + 1;
+	counts.num_sparse_cells++;
+	return n;
+}
+
+////////////////////////////////////////////////////////////////
+// doubles the sparse hash table -- or, if that would take more memory than the dense buffer, turns dense.
+inline
+void
+grow_sparse_counts( CountTensor & counts ){
+
+	size_t const num_slots = 2 * counts.sparse_cells.size();
+	size_t const value_size = ( counts.count_type == FLOAT_COUNTS ) ? sizeof( float ) : sizeof( double );
+	bool const make_dense = ( num_slots * ( sizeof( __uint64 ) + value_size ) >= num_count_cells( counts ) * value_size );
+
+	CountTensor new_counts;
+	new_counts.count_type = counts.count_type;
+	new_counts.num_expt_ids = counts.num_expt_ids;
+	new_counts.num_sequences = counts.num_sequences;
+	new_counts.num_positions = counts.num_positions;
+	new_counts.sparse = !make_dense;
+	if ( make_dense ) {
+		allocate_count_values( new_counts, num_count_cells( counts ) );
+	} else {
+		new_counts.sparse_cells.assign( num_slots, 0 );
+		allocate_count_values( new_counts, num_slots );
+	}
+
+	for ( size_t m = 0; m < counts.sparse_cells.size(); m++ ){
+		if ( counts.sparse_cells[ m ] == 0 ) continue;
+		size_t const cell = counts.sparse_cells[ m ] - 1;
+		add_count_slot( new_counts, make_dense ? cell : insert_count_slot( new_counts, cell ), counts, m );
+	}
+
+	counts.sparse = new_counts.sparse;
+	counts.sparse_cells.swap( new_counts.sparse_cells );
+	counts.double_counts.swap( new_counts.double_counts );
+	counts.float_counts.swap( new_counts.float_counts );
+	counts.fixed_point_counts.swap( new_counts.fixed_point_counts );
+	counts.num_sparse_cells = new_counts.num_sparse_cells;
+}
+
+////////////////////////////////////////////////////////////////
+// adds the value in slot m of other_counts into slot n of counts [same value type].
+inline
+void
+add_count_slot( CountTensor & counts, size_t const n, CountTensor const & other_counts, size_t const m ){
+	switch ( counts.count_type ){
+	case DOUBLE_COUNTS:      counts.double_counts[ n ] += other_counts.double_counts[ m ]; break;
+	case FLOAT_COUNTS:       counts.float_counts[ n ] += other_counts.float_counts[ m ]; break;
+	case FIXED_POINT_COUNTS: counts.fixed_point_counts[ n ] += other_counts.fixed_point_counts[ m ]; break;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// multiplicity: for --dedup, the number of copies of the read pair; same as adding weight that many times.
+inline
+void
+add_count( CountTensor & counts, unsigned const expt_idx, unsigned const sid_idx, unsigned const pos, float const weight, unsigned const multiplicity ){
+	size_t n = count_index( counts, expt_idx, sid_idx, pos );
+	if ( counts.sparse ) n = insert_count_slot( counts, n );
+	switch ( counts.count_type ){
+	case DOUBLE_COUNTS:      counts.double_counts[ n ] += double( weight ) * multiplicity; break;
+	case FLOAT_COUNTS:       counts.float_counts[ n ] += weight * multiplicity; break;
+	case FIXED_POINT_COUNTS: counts.fixed_point_counts[ n ] += __uint64( weight * fixed_point_count_scale + 0.5 ) * multiplicity; break;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+double
+get_count_in_slot( CountTensor const & counts, size_t const n ){
+	switch ( counts.count_type ){
+	case FLOAT_COUNTS:       return counts.float_counts[ n ];
+	case FIXED_POINT_COUNTS: return double( counts.fixed_point_counts[ n ] ) / fixed_point_count_scale;
+	default:                 return counts.double_counts[ n ];
+	}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+double
+get_count( CountTensor const & counts, unsigned const expt_idx, unsigned const sid_idx, unsigned const pos ){
+	size_t n = count_index( counts, expt_idx, sid_idx, pos );
+	if ( counts.sparse ) {
+		n = find_count_slot( counts, n );
+		if ( n == size_t( -1 ) ) return 0.0;
+	}
+	return get_count_in_slot( counts, n );
+}
+
+////////////////////////////////////////////////////////////////
+// cells that have counts, in order, and the slots holding their values.
+inline
+void
+get_nonzero_cells( CountTensor const & counts, std::vector< size_t > & cells, std::vector< size_t > & slots ){
+
+	cells.clear();
+	slots.clear();
+	if ( !counts.sparse ) {
+		size_t const num_cells = num_count_cells( counts );
+		for ( size_t n = 0; n < num_cells; n++ ){
+			if ( get_count_in_slot( counts, n ) == 0.0 ) continue;
+			cells.push_back( n );
+			slots.push_back( n );
+		}
+		return;
+	}
+
+	std::vector< std::pair< size_t, size_t > > cell_slots;
+	cell_slots.reserve( counts.num_sparse_cells );
+	for ( size_t m = 0; m < counts.sparse_cells.size(); m++ ){
+		if ( counts.sparse_cells[ m ] != 0 ) cell_slots.push_back( std::make_pair( size_t( counts.sparse_cells[ m ] - 1 ), m ) );
+	}
+	std::sort( cell_slots.begin(), cell_slots.end() );
+	for ( unsigned n = 0; n < cell_slots.size(); n++ ){
+		cells.push_back( cell_slots[ n ].first );
+		slots.push_back( cell_slots[ n ].second );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// add another copy of the counts (e.g., from another thread) into these. If these are still empty, they
+// just become a copy.
+inline
+void
+merge_counts( CountTensor & counts, CountTensor const & other_counts ){
+
+	if ( counts.num_expt_ids == 0 ) {
+		counts = other_counts;
+		return;
+	}
+	SEQAN_ASSERT_EQ( counts.count_type, other_counts.count_type );
+	SEQAN_ASSERT_EQ( counts.num_expt_ids, other_counts.num_expt_ids );
+	SEQAN_ASSERT_EQ( counts.num_sequences, other_counts.num_sequences );
+	SEQAN_ASSERT_EQ( counts.num_positions, other_counts.num_positions );
+
+	if ( !counts.sparse && !other_counts.sparse ) {
+		// flat buffers, so these loops vectorize.
+		size_t const num_cells = num_count_cells( counts );
+		switch ( counts.count_type ){
+		case DOUBLE_COUNTS:
+			for ( size_t n = 0; n < num_cells; n++ ) counts.double_counts[ n ] += other_counts.double_counts[ n ];
+			break;
+		case FLOAT_COUNTS:
+			for ( size_t n = 0; n < num_cells; n++ ) counts.float_counts[ n ] += other_counts.float_counts[ n ];
+			break;
+		case FIXED_POINT_COUNTS:
+			for ( size_t n = 0; n < num_cells; n++ ) counts.fixed_point_counts[ n ] += other_counts.fixed_point_counts[ n ];
+			break;
+		}
+		return;
+	}
+
+	std::vector< size_t > cells, slots;
+	get_nonzero_cells( other_counts, cells, slots );
+	for ( size_t q = 0; q < cells.size(); q++ ){
+		size_t const n = counts.sparse ? insert_count_slot( counts, cells[ q ] ) : cells[ q ];
+		add_count_slot( counts, n, other_counts, slots[ q ] );
+	}
+}
+
+//////////////////////////////////////
+// Creates the output directory for -O [and any missing parents], e.g. for the condor DAGMan reducer,
+// which gets pointed at a directory that the jobs may not have made.
+inline
+bool
+make_output_dir( std::string const & outpath ){
+
+	for ( size_t slash = outpath.find( '/', 1 ); slash != std::string::npos; slash = outpath.find( '/', slash + 1 ) ){
+		std::string const dirname = outpath.substr( 0, slash );
+		if ( mkdir( dirname.c_str(), 0777 ) != 0 && errno != EEXIST ) {
+			std::cerr << "ERROR! Could not create output path " << dirname << ": " << strerror( errno ) << std::endl; return false;
+		}
+	}
+
+	struct stat out_stat;
+	if ( outpath.size() > 0 && ( stat( outpath.c_str(), &out_stat ) != 0 || !S_ISDIR( out_stat.st_mode ) ) ) {
+		std::cerr << "ERROR! Output path " << outpath << " is not a directory." << std::endl; return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////
+inline
+void
+output_stats_files( CountTensor const & all_count,
+										std::string const & outpath,
+										std::string const file_prefix )
+{
+
+  unsigned const seqCount_expt_id = all_count.num_expt_ids;
+  std::cout << std::endl;
+  //////////////////////////////////////////////////////
+  //  output matrices with stored counts.
+  //////////////////////////////////////////////////////
+  for ( unsigned i = 0; i < seqCount_expt_id; i++ ){
+    char stats_outFileName[ 100 ];
+    sprintf( stats_outFileName, "%s%s_ID%d.txt", outpath.c_str(), file_prefix.c_str(), i+1 ); // index by 1.
+    std::cout << "Outputting counts to: " << stats_outFileName << std::endl;
+    FILE * stats_oFile;
+    stats_oFile = fopen( stats_outFileName,"w");
+    if ( stats_oFile == 0 ) { std::cerr << "Problem with file: " << stats_outFileName << " [" << strerror( errno ) << "]" << std::endl; exit( 0 ); }
+
+    unsigned const seqCount_library = all_count.num_sequences;
+    for ( unsigned j = 0; j < seqCount_library; j++ ){
+      double total_for_RNA( 0.0 );
+
+      unsigned const max_rna_len_plus_one = all_count.num_positions;
+      for ( unsigned k = 0; k < (max_rna_len_plus_one); k++ ){
+				double const count = get_count( all_count, i, j, k );
+				fprintf( stats_oFile, " %10.3f", count );
+				total_for_RNA += count;
+      }
+      //      std::cout << i << " " << j << " " << get_count( all_count, i, j, 0 ) << " " << max_rna_len_plus_one << " " << total_for_RNA << " " << std::endl; // was used to check if total was integer.
+      fprintf( stats_oFile, "\n");
+    }
+    fclose( stats_oFile );
+  }
+}
+
+////////////////////////////////////////////////////////////////
+// Same counts as output_stats_files(), but only the nonzero ones, one per line: sequence ID and position
+// [the row and column in stats_ID*.txt, both counting from 1] and count. The last cell always gets written,
+// even if zero, so that e.g. matlab's sparse( d(:,1), d(:,2), d(:,3) ) comes out with the full dimensions.
+inline
+void
+output_sparse_stats_files( CountTensor const & all_count,
+			   std::string const & outpath,
+			   std::string const file_prefix )
+{
+  std::vector< size_t > cells, slots;
+  get_nonzero_cells( all_count, cells, slots );
+
+  unsigned const seqCount_expt_id = all_count.num_expt_ids;
+  size_t const cells_per_expt_id = size_t( all_count.num_sequences ) * all_count.num_positions;
+  unsigned q = 0;
+  std::cout << std::endl;
+  for ( unsigned i = 0; i < seqCount_expt_id; i++ ){
+    char stats_outFileName[ 100 ];
+    sprintf( stats_outFileName, "%s%s_ID%d.sparse.txt", outpath.c_str(), file_prefix.c_str(), i+1 ); // index by 1.
+    std::cout << "Outputting counts to: " << stats_outFileName << std::endl;
+    FILE * stats_oFile;
+    stats_oFile = fopen( stats_outFileName,"w");
+    if ( stats_oFile == 0 ) { std::cerr << "Problem with file: " << stats_outFileName << " [" << strerror( errno ) << "]" << std::endl; exit( 0 ); }
+
+    size_t const last_cell = ( i + 1 ) * cells_per_expt_id - 1;
+    bool wrote_last_cell( false );
+    for ( ; q < cells.size() && cells[ q ] <= last_cell; q++ ){
+      size_t const cell = cells[ q ] - i * cells_per_expt_id;
+      fprintf( stats_oFile, "%u %u %10.3f\n", unsigned( cell / all_count.num_positions ) + 1, unsigned( cell % all_count.num_positions ) + 1,
+	       get_count_in_slot( all_count, slots[ q ] ) );
+      if ( cells[ q ] == last_cell ) wrote_last_cell = true;
+    }
+    if ( !wrote_last_cell && cells_per_expt_id > 0 ) fprintf( stats_oFile, "%u %u %10.3f\n", all_count.num_sequences, all_count.num_positions, 0.0 );
+    fclose( stats_oFile );
+  }
+}
+
+#endif
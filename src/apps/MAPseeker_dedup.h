@@ -0,0 +1,274 @@
+#ifndef MAPSEEKER_DEDUP_H
+#define MAPSEEKER_DEDUP_H
+
+#include <cstring>
+#include <vector>
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/file.h>
+#include <seqan/pipe.h>
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// --dedup: MAP-seq libraries are very redundant, and align_read_pair() only depends on the two
+// read sequences, so each distinct read pair needs to be aligned once, with its counts multiplied
+// by the number of copies.
+//
+// Read pairs are packed 3 bits per nucleotide [A,C,G,T,N] into fixed-size records, and counted in
+// a hash table. When the table holds read_pair_table_max_entries distinct pairs, they get spilled
+// to an external string on disk and the table starts over. At the end, if anything was spilled,
+// all records go through seqan's external sorter (Pool with SorterSpec), which brings copies of
+// the same pair together so their multiplicities can be summed. Memory use is bounded by the table
+// and the sorter's buffers, not by the number of reads.
+//
+// Pairs that cannot be packed [longer than max_packed_read_length, or other characters] are left
+// to the caller to align directly.
+////////////////////////////////////////////////////////////////
+
+unsigned const packed_read_words( 16 );
+unsigned const nucleotides_per_packed_word( 21 );
+unsigned const max_packed_read_length( packed_read_words * nucleotides_per_packed_word );
+
+// about 270 MB of records, plus the index into them.
+size_t const read_pair_table_max_entries( 1 << 20 );
+
+// read 1 in words[0 ... 15], read 2 in words[16 ... 31]; unused nucleotides are 0.
+struct ReadPairRecord {
+	__uint64 words[ 2 * packed_read_words ];
+	__uint64 multiplicity;
+};
+
+// orders by sequence only, so that copies of a read pair end up next to each other.
+// [the sorter reads the argument types off the comparator, which std::binary_function used to supply.]
+struct ReadPairRecordCompare {
+	typedef ReadPairRecord first_argument_type;
+	typedef ReadPairRecord second_argument_type;
+	typedef int result_type;
+
+	inline int operator()( ReadPairRecord const & a, ReadPairRecord const & b ) const {
+		return memcmp( a.words, b.words, sizeof( a.words ) );
+	}
+};
+
+typedef Pool< ReadPairRecord, SorterSpec< SorterConfigSize< ReadPairRecordCompare, __int64 > > > TReadPairSorter;
+
+struct ReadPairTable {
+	ReadPairTable();
+
+	std::vector< ReadPairRecord > records; // distinct read pairs, in the order first seen.
+	std::vector< unsigned > index; // hash slot --> position in records, or empty_read_pair_slot.
+	String< ReadPairRecord, External<> > spilled;
+	TReadPairSorter sorter;
+	bool sorted;
+	size_t next_record;  // for reading out the table when nothing was spilled.
+	ReadPairRecord next_sorted; // for reading out the sorter: first copy of the next read pair, if have_next_sorted.
+	bool have_next_sorted;
+	unsigned long num_read_pairs, num_unique_read_pairs;
+};
+
+template < typename TSeq >
+bool
+pack_read( __uint64 * words, TSeq const & seq );
+
+template < typename TSeq >
+bool
+pack_read_pair( ReadPairRecord & record, TSeq const & seq1, TSeq const & seq2 );
+
+void
+unpack_read( CharString & seq, __uint64 const * words );
+
+void
+unpack_read_pair( CharString & seq1, CharString & seq2, ReadPairRecord const & record );
+
+__uint64
+hash_read_pair( ReadPairRecord const & record );
+
+void
+add_read_pair( ReadPairTable & table, ReadPairRecord const & record );
+
+void
+spill_read_pair_table( ReadPairTable & table );
+
+void
+finish_read_pair_table( ReadPairTable & table );
+
+bool
+get_next_unique_read_pair( ReadPairTable & table, ReadPairRecord & record );
+
+////////////////////////////////////////////////////////////////
+unsigned const empty_read_pair_slot( ~0u );
+
+inline
+ReadPairTable::ReadPairTable():
+	index( 1024, empty_read_pair_slot ),
+	sorted( false ),
+	next_record( 0 ),
+	have_next_sorted( false ),
+	num_read_pairs( 0 ),
+	num_unique_read_pairs( 0 )
+{}
+
+////////////////////////////////////////////////////////////////
+// same codes as pack_nucleotide(), starting at 1, so the length of the read is implied.
+template < typename TSeq >
+inline
+bool
+pack_read( __uint64 * words, TSeq const & seq ){
+	if ( length( seq ) > max_packed_read_length ) return false;
+	for ( unsigned n = 0; n < packed_read_words; n++ ) words[ n ] = 0;
+	for ( unsigned i = 0; i < length( seq ); i++ ){
+		__uint64 code;
+		switch ( seq[ i ] ){
+		case 'A': code = 1; break;
+		case 'C': code = 2; break;
+		case 'G': code = 3; break;
+		case 'T': code = 4; break;
+		case 'N': code = 5; break;
+		default: return false;
+		}
+		words[ i / nucleotides_per_packed_word ] |= code << ( 3 * ( i % nucleotides_per_packed_word ) );
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+template < typename TSeq >
+inline
+bool
+pack_read_pair( ReadPairRecord & record, TSeq const & seq1, TSeq const & seq2 ){
+	record.multiplicity = 1;
+	return ( pack_read( record.words, seq1 ) && pack_read( record.words + packed_read_words, seq2 ) );
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+unpack_read( CharString & seq, __uint64 const * words ){
+	static char const nucleotides[] = "?ACGTN??";
+	clear( seq );
+	for ( unsigned i = 0; i < max_packed_read_length; i++ ){
+		unsigned const code = ( words[ i / nucleotides_per_packed_word ] >> ( 3 * ( i % nucleotides_per_packed_word ) ) ) & 7;
+		if ( code == 0 ) break;
+		appendValue( seq, nucleotides[ code ] );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+unpack_read_pair( CharString & seq1, CharString & seq2, ReadPairRecord const & record ){
+	unpack_read( seq1, record.words );
+	unpack_read( seq2, record.words + packed_read_words );
+}
+
+////////////////////////////////////////////////////////////////
+inline
+__uint64
+hash_read_pair( ReadPairRecord const & record ){
+	__uint64 hash( 0 );
+	for ( unsigned n = 0; n < 2 * packed_read_words; n++ ){
+		hash = ( hash ^ record.words[ n ] ) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+add_read_pair( ReadPairTable & table, ReadPairRecord const & record ){
+	table.num_read_pairs += record.multiplicity;
+
+	// keep the table at most half full.
+	if ( 2 * ( table.records.size() + 1 ) > table.index.size() ){
+		table.index.assign( 2 * table.index.size(), empty_read_pair_slot );
+		size_t const mask = table.index.size() - 1;
+		for ( unsigned r = 0; r < table.records.size(); r++ ){
+			size_t slot = hash_read_pair( table.records[ r ] ) & mask;
+			while ( table.index[ slot ] != empty_read_pair_slot ) slot = ( slot + 1 ) & mask;
+			table.index[ slot ] = r;
+		}
+	}
+
+	size_t const mask = table.index.size() - 1;
+	size_t slot = hash_read_pair( record ) & mask;
+	while ( table.index[ slot ] != empty_read_pair_slot ){
+		ReadPairRecord & other = table.records[ table.index[ slot ] ];
+		if ( memcmp( other.words, record.words, sizeof( record.words ) ) == 0 ) {
+			other.multiplicity += record.multiplicity;
+			return;
+		}
+		slot = ( slot + 1 ) & mask;
+	}
+	table.index[ slot ] = table.records.size();
+	table.records.push_back( record );
+
+	if ( table.records.size() >= read_pair_table_max_entries ) spill_read_pair_table( table );
+}
+
+////////////////////////////////////////////////////////////////
+// moves the distinct read pairs so far to disk; the same pair may get spilled again later.
+inline
+void
+spill_read_pair_table( ReadPairTable & table ){
+	for ( unsigned r = 0; r < table.records.size(); r++ ) appendValue( table.spilled, table.records[ r ] );
+	table.records.clear();
+	table.index.assign( table.index.size(), empty_read_pair_slot );
+}
+
+////////////////////////////////////////////////////////////////
+// call once all read pairs are in; then get_next_unique_read_pair() reads out the distinct ones.
+inline
+void
+finish_read_pair_table( ReadPairTable & table ){
+	table.next_record = 0;
+	table.sorted = ( length( table.spilled ) > 0 );
+	if ( !table.sorted ) {
+		table.num_unique_read_pairs = table.records.size();
+		return;
+	}
+
+	spill_read_pair_table( table );
+	std::vector< ReadPairRecord >().swap( table.records );
+	std::vector< unsigned >().swap( table.index );
+
+	resize( table.sorter, length( table.spilled ) );
+	beginWrite( table.sorter );
+	for ( __int64 r = 0; r < __int64( length( table.spilled ) ); r++ ) push( table.sorter, table.spilled[ r ] );
+	endWrite( table.sorter );
+	clear( table.spilled );
+
+	beginRead( table.sorter );
+	table.have_next_sorted = !eof( table.sorter );
+	if ( table.have_next_sorted ) pop( table.sorter, table.next_sorted );
+}
+
+////////////////////////////////////////////////////////////////
+// returns false when there are no more. Not thread-safe -- callers take turns.
+inline
+bool
+get_next_unique_read_pair( ReadPairTable & table, ReadPairRecord & record ){
+	if ( !table.sorted ) {
+		if ( table.next_record >= table.records.size() ) return false;
+		record = table.records[ table.next_record++ ];
+		return true;
+	}
+
+	if ( !table.have_next_sorted ) return false;
+	record = table.next_sorted;
+	table.have_next_sorted = false;
+	while ( !eof( table.sorter ) ){
+		pop( table.sorter, table.next_sorted );
+		if ( ReadPairRecordCompare()( record, table.next_sorted ) != 0 ) {
+			table.have_next_sorted = true;
+			break;
+		}
+		record.multiplicity += table.next_sorted.multiplicity;
+	}
+	if ( !table.have_next_sorted ) endRead( table.sorter );
+	table.num_unique_read_pairs++;
+	return true;
+}
+
+#endif  // #ifndef MAPSEEKER_DEDUP_H
@@ -0,0 +1,445 @@
+// -*- mode:c++;tab-width:2;indent-tabs-mode:t;show-trailing-whitespace:t;rm-trailing-spaces:t -*-
+// vi: set ts=2 noet:
+// :noTabs=false:tabSize=4:indentSize=4:
+//
+// (c) Copyright Laboratory of Rhiju Das, Stanford University.
+
+// Sums up MAPseeker outputs from several jobs [e.g., cluster jobs run with --byte_range, or with
+// --start_at_read and --increment_between_reads]. Replaces cat_stats.py.
+//
+// For each <prefix>_ID<n>.txt found in any of the job directories, writes <outpath><prefix>_ID<n>.txt with
+// the summed counts, in the same " %10.3f" layout that MAPseeker writes. Also sums up sparse outputs
+// [<prefix>_ID<n>.sparse.txt] and binary outputs [<prefix>.bin].
+//
+// Counts are parsed straight out of memory-mapped files into integer thousandths, so sums do not depend
+// on the order of the jobs. Jobs get parsed in parallel, into one buffer per thread, and the buffers get
+// added up at the end.
+//
+// Text outputs hold counts rounded to thousandths, so summing fractional counts [e.g., from -A runs] can
+// be off by a few thousandths compared to a single full run. Binary outputs [MAPseeker -B] hold the
+// counts at full precision, and merge exactly.
+
+#define SEQAN_PROFILE // enable time measurements
+
+#include <glob.h>
+#include <apps/MAPseeker_count_file.h>
+#include <seqan/parallel.h>
+#include <seqan/misc/misc_cmdparser.h>
+
+typedef String<char, MMap<> > TStatsMMap;
+
+void
+get_job_dirnames( CommandLineParser const & parser, std::vector< std::string > & dirnames );
+
+void
+find_stats_files( std::vector< std::string > const & dirnames,
+									std::string const & file_prefix,
+									std::string const & file_suffix,
+									std::vector< std::string > & basenames );
+
+bool
+parse_milli_count( char const * & p, char const * const end, __int64 & milli_count );
+
+bool
+get_stats_text_dimensions( std::string const & filename, unsigned & num_rows, unsigned & num_cols );
+
+bool
+add_stats_text_file( std::string const & filename, unsigned const num_rows, unsigned const num_cols, std::vector< __int64 > & sums, bool & fractional );
+
+bool
+add_sparse_stats_text_file( std::string const & filename, std::vector< unsigned > & sids, std::vector< unsigned > & positions, std::vector< __int64 > & milli_counts, bool & fractional );
+
+void
+warn_fractional_sum( std::string const & out_filename );
+
+unsigned
+write_milli_count( char * buffer, __int64 const milli_count );
+
+bool
+merge_stats_text_files( std::vector< std::string > const & filenames, std::string const & out_filename, unsigned const num_threads );
+
+bool
+merge_sparse_stats_text_files( std::vector< std::string > const & filenames, std::string const & out_filename );
+
+bool
+merge_count_files( std::vector< std::string > const & filenames, std::string const & out_filename );
+
+//Versioning information
+inline void
+_addVersion(CommandLineParser& parser) {
+	addVersionLine(parser, "Version 1.0");
+}
+
+int main(int argc, const char *argv[]) {
+
+	CommandLineParser parser;
+	_addVersion(parser);
+
+	addTitleLine(parser, "                                                 ");
+	addTitleLine(parser, "*************************************************");
+	addTitleLine(parser, "* MAP-Seeker merge of job outputs               *");
+	addTitleLine(parser, "* (c) Copyright 2013, R. Das                    *");
+	addTitleLine(parser, "*************************************************");
+	addTitleLine(parser, "                                                 ");
+
+	addUsageLine(parser, " [-O <out path>] <job directory 1> <job directory 2> ...");
+	addUsageLine(parser, " [text stats files hold counts rounded to 0.001; for exact sums of fractional counts (-A), run jobs with -B]");
+
+	addSection(parser, "Main Options:");
+	addOption(parser, addArgumentText(CommandLineOption("O", "outpath", "output path for merged stats files", OptionType::String, ""), "<out path>"));
+	addOption(parser, addArgumentText(CommandLineOption("f", "file_prefixes", "comma-separated prefixes of files to merge", OptionType::String, "stats,strict_stats"), "<prefixes>"));
+	addOption(parser, addArgumentText(CommandLineOption("t", "threads", "number of threads to use", OptionType::Int, 1), "<int>"));
+	requiredArguments(parser, 1);
+
+	if (argc == 1) {
+		shortHelp(parser, std::cerr);	// print short help and exit
+		return 0;
+	}
+
+	if (!parse(parser, argc, argv, std::cerr)) exit( 0 );
+	if (isSetLong(parser, "help") || isSetLong(parser, "version")) return 0;	// print help or version and exit
+
+	SEQAN_PROTIMESTART(mergeTime);
+	std::string outpath, file_prefixes( "stats,strict_stats" );
+	unsigned num_threads( 1 );
+	int threads_option( 1 );
+	getOptionValueLong(parser, "outpath",outpath);
+	if ( outpath.size() > 0 && outpath[ outpath.size()-1 ] != '/' ) outpath += '/';
+	if ( !make_output_dir( outpath ) ) exit( 0 );
+	getOptionValueLong(parser, "file_prefixes",file_prefixes);
+	getOptionValueLong(parser, "threads",threads_option);
+	if ( threads_option < 1 ) { std::cerr << "ERROR! --threads must be at least 1: " << threads_option << std::endl; exit( 0 ); }
+	if ( threads_option > omp_get_max_threads() ) threads_option = omp_get_max_threads();
+	num_threads = threads_option;
+
+	std::vector< std::string > dirnames;
+	get_job_dirnames( parser, dirnames );
+
+	file_prefixes += ',';
+	for ( size_t prefix_begin = 0, prefix_end; ( prefix_end = file_prefixes.find( ',', prefix_begin ) ) != std::string::npos; prefix_begin = prefix_end + 1 ){
+		std::string const file_prefix = file_prefixes.substr( prefix_begin, prefix_end - prefix_begin );
+		if ( file_prefix.size() == 0 ) continue;
+
+		std::vector< std::string > basenames;
+		find_stats_files( dirnames, file_prefix, ".txt", basenames );
+		for ( unsigned i = 0; i < basenames.size(); i++ ){
+			std::vector< std::string > filenames;
+			for ( unsigned n = 0; n < dirnames.size(); n++ ){
+				std::string const filename = dirnames[ n ] + basenames[ i ];
+				if ( std::ifstream( filename.c_str() ).good() ) filenames.push_back( filename );
+			}
+			if ( !merge_stats_text_files( filenames, outpath + basenames[ i ], num_threads ) ) exit( 0 );
+		}
+
+		find_stats_files( dirnames, file_prefix, ".sparse.txt", basenames );
+		for ( unsigned i = 0; i < basenames.size(); i++ ){
+			std::vector< std::string > filenames;
+			for ( unsigned n = 0; n < dirnames.size(); n++ ){
+				std::string const filename = dirnames[ n ] + basenames[ i ];
+				if ( std::ifstream( filename.c_str() ).good() ) filenames.push_back( filename );
+			}
+			if ( !merge_sparse_stats_text_files( filenames, outpath + basenames[ i ] ) ) exit( 0 );
+		}
+
+		std::vector< std::string > filenames;
+		for ( unsigned n = 0; n < dirnames.size(); n++ ){
+			std::string const filename = dirnames[ n ] + file_prefix + ".bin";
+			if ( std::ifstream( filename.c_str() ).good() ) filenames.push_back( filename );
+		}
+		if ( filenames.size() > 0 && !merge_count_files( filenames, outpath + file_prefix + ".bin" ) ) exit( 0 );
+	}
+
+	std::cout << "Merging " << dirnames.size() << " job directories took " << SEQAN_PROTIMEDIFF(mergeTime) << " seconds." << std::endl;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// Job directories from the command line. Patterns like out/*/ get expanded here too, since condor
+// DAGMan scripts do not go through a shell.
+void
+get_job_dirnames( CommandLineParser const & parser, std::vector< std::string > & dirnames ){
+
+	for ( unsigned n = 0; n < argumentCount( parser ); n++ ){
+		std::string const pattern = toCString( getArgumentValue( parser, n ) );
+		glob_t glob_result;
+		if ( glob( pattern.c_str(), GLOB_NOCHECK, NULL, &glob_result ) != 0 ) continue;
+		for ( size_t m = 0; m < glob_result.gl_pathc; m++ ){
+			std::string dirname( glob_result.gl_pathv[ m ] );
+			if ( dirname.size() > 0 && dirname[ dirname.size()-1 ] != '/' ) dirname += '/';
+			dirnames.push_back( dirname );
+		}
+		globfree( &glob_result );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// <prefix>_ID<n><suffix> in any of the directories, in order of n.
+void
+find_stats_files( std::vector< std::string > const & dirnames,
+									std::string const & file_prefix,
+									std::string const & file_suffix,
+									std::vector< std::string > & basenames ){
+
+	std::vector< unsigned > expt_ids;
+	for ( unsigned n = 0; n < dirnames.size(); n++ ){
+		std::string const pattern = dirnames[ n ] + file_prefix + "_ID*" + file_suffix;
+		glob_t glob_result;
+		if ( glob( pattern.c_str(), 0, NULL, &glob_result ) != 0 ) continue;
+		for ( size_t m = 0; m < glob_result.gl_pathc; m++ ){
+			// the * has to be just digits -- stats_ID1.sparse.txt is not a stats_ID*.txt file.
+			std::string const id = std::string( glob_result.gl_pathv[ m ] ).substr( pattern.size() - file_suffix.size() - 1 );
+			std::string const id_digits = id.substr( 0, id.size() - file_suffix.size() );
+			if ( id_digits.size() == 0 || id_digits.find_first_not_of( "0123456789" ) != std::string::npos ) continue;
+			unsigned const expt_id = atoi( id_digits.c_str() );
+			if ( std::find( expt_ids.begin(), expt_ids.end(), expt_id ) == expt_ids.end() ) expt_ids.push_back( expt_id );
+		}
+		globfree( &glob_result );
+	}
+	std::sort( expt_ids.begin(), expt_ids.end() );
+
+	basenames.clear();
+	for ( unsigned i = 0; i < expt_ids.size(); i++ ){
+		char basename[ 100 ];
+		sprintf( basename, "%s_ID%d%s", file_prefix.c_str(), expt_ids[ i ], file_suffix.c_str() );
+		basenames.push_back( basename );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// next number on the line, e.g. "   12.333", in thousandths [rounded, if there are more digits].
+// Returns false at the end of the line.
+inline
+bool
+parse_milli_count( char const * & p, char const * const end, __int64 & milli_count ){
+
+	while ( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' ) ) p++;
+	if ( p == end || *p == '\n' ) return false;
+
+	bool const negative = ( *p == '-' );
+	if ( negative ) p++;
+	milli_count = 0;
+	for ( ; p < end && *p >= '0' && *p <= '9'; p++ ) milli_count = 10 * milli_count + ( *p - '0' );
+	milli_count *= 1000;
+	if ( p < end && *p == '.' ) {
+		p++;
+		__int64 const place[ 3 ] = { 100, 10, 1 };
+		for ( unsigned num_decimals = 0; p < end && *p >= '0' && *p <= '9'; p++, num_decimals++ ){
+			if ( num_decimals < 3 ) milli_count += place[ num_decimals ] * ( *p - '0' );
+			else if ( num_decimals == 3 && *p >= '5' ) milli_count++; // round.
+		}
+	}
+	if ( negative ) milli_count = -milli_count;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+bool
+get_stats_text_dimensions( std::string const & filename, unsigned & num_rows, unsigned & num_cols ){
+
+	TStatsMMap mapping;
+	if ( !open( mapping, filename.c_str(), OPEN_RDONLY ) ) { std::cerr << "Problem with file: " << filename << std::endl; return false; }
+	num_rows = 0;
+	num_cols = 0;
+	if ( length( mapping ) == 0 ) return true;
+
+	char const * p = &mapping[0];
+	char const * const end = p + length( mapping );
+	__int64 milli_count;
+	while ( parse_milli_count( p, end, milli_count ) ) num_cols++;
+	for ( ; p < end; p++ ) if ( *p == '\n' ) num_rows++;
+	if ( end[ -1 ] != '\n' ) num_rows++;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+bool
+add_stats_text_file( std::string const & filename, unsigned const num_rows, unsigned const num_cols, std::vector< __int64 > & sums, bool & fractional ){
+
+	TStatsMMap mapping;
+	if ( !open( mapping, filename.c_str(), OPEN_RDONLY ) ) { std::cerr << "Problem with file: " << filename << std::endl; return false; }
+	if ( length( mapping ) == 0 && num_rows == 0 ) return true;
+	if ( length( mapping ) == 0 ) { std::cerr << "ERROR! Empty file: " << filename << std::endl; return false; }
+
+	char const * p = &mapping[0];
+	char const * const end = p + length( mapping );
+	__int64 milli_count;
+	for ( unsigned j = 0; j < num_rows; j++ ){
+		__int64 * row = &sums[ size_t( j ) * num_cols ];
+		unsigned k = 0;
+		for ( ; parse_milli_count( p, end, milli_count ); k++ ){
+			if ( k < num_cols ) row[ k ] += milli_count;
+			if ( milli_count % 1000 != 0 ) fractional = true;
+		}
+		if ( k != num_cols ) {
+			std::cerr << "ERROR! Expected " << num_cols << " columns but got " << k << " in line " << j+1 << " of " << filename << std::endl; return false;
+		}
+		if ( p < end ) p++; // newline.
+	}
+	while ( p < end && isspace( *p ) ) p++;
+	if ( p != end ) { std::cerr << "ERROR! Expected " << num_rows << " lines in " << filename << std::endl; return false; }
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// writes a count of thousandths like fprintf( " %10.3f" ) would, and returns the number of characters.
+inline
+unsigned
+write_milli_count( char * buffer, __int64 const milli_count ){
+
+	char digits[ 32 ];
+	unsigned num_digits = 0;
+	__uint64 value = ( milli_count < 0 ) ? -milli_count : milli_count;
+	do {
+		digits[ num_digits++ ] = '0' + value % 10;
+		value /= 10;
+		if ( num_digits == 3 ) digits[ num_digits++ ] = '.';
+	} while ( value > 0 || num_digits < 5 );
+	if ( milli_count < 0 ) digits[ num_digits++ ] = '-';
+
+	unsigned n = 0;
+	buffer[ n++ ] = ' ';
+	for ( unsigned q = num_digits; q < 10; q++ ) buffer[ n++ ] = ' ';
+	while ( num_digits > 0 ) buffer[ n++ ] = digits[ --num_digits ];
+	return n;
+}
+
+////////////////////////////////////////////////////////////////
+bool
+merge_stats_text_files( std::vector< std::string > const & filenames, std::string const & out_filename, unsigned const num_threads ){
+
+	unsigned num_rows, num_cols;
+	if ( !get_stats_text_dimensions( filenames[ 0 ], num_rows, num_cols ) ) return false;
+	size_t const num_cells = size_t( num_rows ) * num_cols;
+
+	// one buffer of sums for each thread.
+	std::vector< std::vector< __int64 > > thread_sums( num_threads );
+	std::vector< char > thread_fractional( num_threads, false );
+	bool ok( true );
+	int const num_files = filenames.size();
+	SEQAN_OMP_PRAGMA( parallel for num_threads( num_threads ) schedule( dynamic ) )
+	for ( int n = 0; n < num_files; n++ ){
+		std::vector< __int64 > & sums = thread_sums[ omp_get_thread_num() ];
+		if ( sums.size() == 0 ) sums.resize( num_cells, 0 );
+		bool fractional( false );
+		if ( !add_stats_text_file( filenames[ n ], num_rows, num_cols, sums, fractional ) ) ok = false;
+		if ( fractional ) thread_fractional[ omp_get_thread_num() ] = true;
+	}
+	if ( !ok ) return false;
+	if ( num_files > 1 && std::find( thread_fractional.begin(), thread_fractional.end(), true ) != thread_fractional.end() ) warn_fractional_sum( out_filename );
+
+	std::vector< __int64 > & sums = thread_sums[ 0 ];
+	if ( sums.size() == 0 ) sums.resize( num_cells, 0 );
+	for ( unsigned t = 1; t < num_threads; t++ ){
+		if ( thread_sums[ t ].size() == 0 ) continue;
+		__int64 const * other_sums = &thread_sums[ t ][ 0 ];
+		for ( size_t m = 0; m < num_cells; m++ ) sums[ m ] += other_sums[ m ];
+	}
+
+	std::cout << "Outputting counts summed over " << filenames.size() << " jobs to: " << out_filename << std::endl;
+	FILE * stats_oFile = fopen( out_filename.c_str(), "w" );
+	if ( stats_oFile == 0 ) { std::cerr << "Problem with file: " << out_filename << std::endl; return false; }
+	std::vector< char > line( size_t( num_cols ) * 32 + 1 );
+	for ( unsigned j = 0; j < num_rows; j++ ){
+		size_t line_length = 0;
+		for ( unsigned k = 0; k < num_cols; k++ ) line_length += write_milli_count( &line[ line_length ], sums[ size_t( j ) * num_cols + k ] );
+		line[ line_length++ ] = '\n';
+		fwrite( &line[0], 1, line_length, stats_oFile );
+	}
+	fclose( stats_oFile );
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+bool
+add_sparse_stats_text_file( std::string const & filename, std::vector< unsigned > & sids, std::vector< unsigned > & positions, std::vector< __int64 > & milli_counts, bool & fractional ){
+
+	TStatsMMap mapping;
+	if ( !open( mapping, filename.c_str(), OPEN_RDONLY ) ) { std::cerr << "Problem with file: " << filename << std::endl; return false; }
+	if ( length( mapping ) == 0 ) return true;
+
+	char const * p = &mapping[0];
+	char const * const end = p + length( mapping );
+	__int64 sid, pos, milli_count;
+	while ( parse_milli_count( p, end, sid ) ){
+		if ( !parse_milli_count( p, end, pos ) || !parse_milli_count( p, end, milli_count ) || sid < 1000 || pos < 1000 ) {
+			std::cerr << "ERROR! Expected lines of sequence ID, position, count in " << filename << std::endl; return false;
+		}
+		sids.push_back( sid / 1000 );
+		positions.push_back( pos / 1000 );
+		milli_counts.push_back( milli_count );
+		if ( milli_count % 1000 != 0 ) fractional = true;
+		while ( p < end && *p != '\n' ) p++;
+		while ( p < end && isspace( *p ) ) p++;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+bool
+merge_sparse_stats_text_files( std::vector< std::string > const & filenames, std::string const & out_filename ){
+
+	std::vector< unsigned > sids, positions;
+	std::vector< __int64 > milli_counts;
+	bool fractional( false );
+	for ( unsigned n = 0; n < filenames.size(); n++ ){
+		if ( !add_sparse_stats_text_file( filenames[ n ], sids, positions, milli_counts, fractional ) ) return false;
+	}
+	if ( filenames.size() > 1 && fractional ) warn_fractional_sum( out_filename );
+
+	std::vector< std::pair< std::pair< unsigned, unsigned >, __int64 > > cells;
+	for ( unsigned q = 0; q < sids.size(); q++ ) cells.push_back( std::make_pair( std::make_pair( sids[ q ], positions[ q ] ), milli_counts[ q ] ) );
+	std::sort( cells.begin(), cells.end() );
+
+	std::cout << "Outputting counts summed over " << filenames.size() << " jobs to: " << out_filename << std::endl;
+	FILE * stats_oFile = fopen( out_filename.c_str(), "w" );
+	if ( stats_oFile == 0 ) { std::cerr << "Problem with file: " << out_filename << std::endl; return false; }
+	char count_string[ 40 ];
+	for ( unsigned q = 0; q < cells.size(); ){
+		__int64 milli_count = 0;
+		unsigned r = q;
+		for ( ; r < cells.size() && cells[ r ].first == cells[ q ].first; r++ ) milli_count += cells[ r ].second;
+		// zeros only show up to mark the last cell.
+		if ( milli_count != 0 || r == cells.size() ) {
+			count_string[ write_milli_count( count_string, milli_count ) ] = '\0';
+			fprintf( stats_oFile, "%u %u%s\n", cells[ q ].first.first, cells[ q ].first.second, count_string );
+		}
+		q = r;
+	}
+	fclose( stats_oFile );
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// text counts are rounded to thousandths in each job, so their sum can be off from a single full run.
+void
+warn_fractional_sum( std::string const & out_filename ){
+	std::cout << "WARNING: summing fractional counts from text files into " << out_filename <<
+		"; these are rounded to 0.001 in each job, so the sums may differ slightly from a single full run. Run jobs with -B for exact merges." << std::endl;
+}
+
+////////////////////////////////////////////////////////////////
+bool
+merge_count_files( std::vector< std::string > const & filenames, std::string const & out_filename ){
+
+	CountTensor all_count;
+	std::vector< std::string > expt_id_names, sequence_names;
+	bool compress( false );
+	for ( unsigned n = 0; n < filenames.size(); n++ ){
+		CountFile count_file;
+		CountTensor counts;
+		if ( !open_count_file( count_file, filenames[ n ] ) ) return false;
+		if ( !load_count_file( count_file, counts ) ) return false;
+		if ( n == 0 ) {
+			expt_id_names = count_file.expt_id_names;
+			sequence_names = count_file.sequence_names;
+			compress = ( count_file.header.flags & COUNT_FILE_COMPRESSED );
+		} else if ( counts.count_type != all_count.count_type || counts.num_expt_ids != all_count.num_expt_ids ||
+								counts.num_sequences != all_count.num_sequences || counts.num_positions != all_count.num_positions ) {
+			std::cerr << "ERROR! Count type or dimensions of " << filenames[ n ] << " do not match " << filenames[ 0 ] << std::endl; return false;
+		}
+		merge_counts( all_count, counts );
+	}
+
+	std::cout << "Outputting counts summed over " << filenames.size() << " jobs to: " << out_filename << std::endl;
+	return write_count_file( all_count, expt_id_names, sequence_names, out_filename, compress );
+}
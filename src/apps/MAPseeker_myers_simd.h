@@ -0,0 +1,275 @@
+#ifndef MAPSEEKER_MYERS_SIMD_H
+#define MAPSEEKER_MYERS_SIMD_H
+
+#include <algorithm>
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define MAPSEEKER_MYERS_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// Read 2 gets searched for in every possible reference, and with --align_all [or big libraries of star
+// designs] that can be dozens or hundreds of them -- most of which it does not match at all. This runs the
+// same bit-parallel recurrence as seqan's Myers<FindInfix> for patterns of up to 64 nts, but against several
+// references at once, one per 64-bit lane of an SSE2 [2 lanes] or AVX2 [4 lanes] register. For each reference
+// it gives the best score (fewest edits, over all end positions) and where the first such match ends.
+//
+// The kernel gets picked at run time, from what the CPU supports; the scalar one does one reference at a time,
+// for other CPUs and compilers.
+////////////////////////////////////////////////////////////////
+
+unsigned const myers_multi_text_max_pattern_length( 64 );
+
+struct MultiTextMyersPattern {
+	__uint64 peq[ 256 ]; // for each character, which pattern positions it matches.
+	unsigned length;
+};
+
+enum MultiTextMyersKernel { SCALAR_MYERS_KERNEL, SSE2_MYERS_KERNEL, AVX2_MYERS_KERNEL };
+
+MultiTextMyersKernel
+get_multi_text_myers_kernel();
+
+unsigned
+get_multi_text_myers_lanes( MultiTextMyersKernel const kernel );
+
+bool
+setup_multi_text_myers_pattern( MultiTextMyersPattern & pattern, CharString const & needle );
+
+void
+find_best_in_texts( MultiTextMyersPattern const & pattern,
+										CharString const * const * texts,
+										unsigned const num_texts,
+										MultiTextMyersKernel const kernel,
+										unsigned * best_errors,
+										int * best_end );
+
+void
+find_best_in_texts_scalar( MultiTextMyersPattern const & pattern,
+													 CharString const & text,
+													 unsigned & best_errors,
+													 int & best_end );
+
+////////////////////////////////////////////////////////////////
+inline
+MultiTextMyersKernel
+get_multi_text_myers_kernel(){
+#ifdef MAPSEEKER_MYERS_SIMD_X86
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) ) return AVX2_MYERS_KERNEL;
+	if ( __builtin_cpu_supports( "sse2" ) ) return SSE2_MYERS_KERNEL;
+#endif
+	return SCALAR_MYERS_KERNEL;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+unsigned
+get_multi_text_myers_lanes( MultiTextMyersKernel const kernel ){
+	switch ( kernel ){
+	case AVX2_MYERS_KERNEL: return 4;
+	case SSE2_MYERS_KERNEL: return 2;
+	default: return 1;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// false if the needle does not fit in one 64-bit word [or is empty].
+inline
+bool
+setup_multi_text_myers_pattern( MultiTextMyersPattern & pattern, CharString const & needle ){
+	pattern.length = length( needle );
+	if ( pattern.length == 0 || pattern.length > myers_multi_text_max_pattern_length ) return false;
+	for ( unsigned c = 0; c < 256; c++ ) pattern.peq[ c ] = 0;
+	for ( unsigned i = 0; i < pattern.length; i++ ) pattern.peq[ (unsigned char) needle[ i ] ] |= __uint64( 1 ) << i;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// same recurrence as _findMyersSmallPatterns() in seqan/find/find_myers_ukkonen.h.
+inline
+void
+find_best_in_texts_scalar( MultiTextMyersPattern const & pattern,
+													 CharString const & text,
+													 unsigned & best_errors,
+													 int & best_end ){
+	__uint64 const last_bit = __uint64( 1 ) << ( pattern.length - 1 );
+	__uint64 VP = ~__uint64( 0 ), VN = 0;
+	unsigned errors = pattern.length;
+	best_errors = pattern.length;
+	best_end = -1;
+	unsigned const text_length = length( text );
+	char const * t = begin( text, Standard() );
+	for ( unsigned j = 0; j < text_length; j++ ){
+		__uint64 X = pattern.peq[ (unsigned char) t[ j ] ] | VN;
+		__uint64 const D0 = ( ( VP + ( X & VP ) ) ^ VP ) | X;
+		__uint64 const HN = VP & D0;
+		__uint64 const HP = VN | ~( VP | D0 );
+		X = HP << 1;
+		VN = X & D0;
+		VP = ( HN << 1 ) | ~( X | D0 );
+		if ( HP & last_bit ) errors++;
+		else if ( HN & last_bit ) errors--;
+		if ( errors < best_errors ){
+			best_errors = errors;
+			best_end = j;
+		}
+	}
+}
+
+#ifdef MAPSEEKER_MYERS_SIMD_X86
+
+////////////////////////////////////////////////////////////////
+// texts past their end read as a character that matches nothing, and do not count.
+inline
+__uint64
+get_multi_text_myers_peq( MultiTextMyersPattern const & pattern, char const * text, unsigned const text_length, unsigned const j ){
+	return ( j < text_length ) ? pattern.peq[ (unsigned char) text[ j ] ] : 0;
+}
+
+////////////////////////////////////////////////////////////////
+// up to 2 texts. Scores stay below 2^31, so comparing the low 32 bits of each lane is enough [SSE2 has no 64-bit compare].
+__attribute__(( target( "sse2" ) ))
+inline
+void
+find_best_in_texts_sse2( MultiTextMyersPattern const & pattern,
+												 CharString const * const * texts,
+												 unsigned const num_texts,
+												 unsigned * best_errors,
+												 int * best_end ){
+	char const * t[ 2 ] = { 0, 0 };
+	unsigned text_length[ 2 ] = { 0, 0 };
+	unsigned max_length( 0 );
+	for ( unsigned l = 0; l < num_texts; l++ ){
+		t[ l ] = begin( *texts[ l ], Standard() );
+		text_length[ l ] = length( *texts[ l ] );
+		if ( text_length[ l ] > max_length ) max_length = text_length[ l ];
+	}
+
+	__m128i const shift = _mm_cvtsi32_si128( pattern.length - 1 );
+	__m128i const one = _mm_set1_epi64x( 1 );
+	__m128i const lengths = _mm_set_epi64x( text_length[ 1 ], text_length[ 0 ] );
+	__m128i VP = _mm_set1_epi64x( -1 ), VN = _mm_setzero_si128();
+	__m128i errors = _mm_set1_epi64x( pattern.length );
+	__m128i best = errors, best_pos = _mm_set1_epi64x( -1 );
+	for ( unsigned j = 0; j < max_length; j++ ){
+		__m128i X = _mm_set_epi64x( get_multi_text_myers_peq( pattern, t[ 1 ], text_length[ 1 ], j ),
+																get_multi_text_myers_peq( pattern, t[ 0 ], text_length[ 0 ], j ) );
+		X = _mm_or_si128( X, VN );
+		__m128i const D0 = _mm_or_si128( _mm_xor_si128( _mm_add_epi64( VP, _mm_and_si128( X, VP ) ), VP ), X );
+		__m128i const HN = _mm_and_si128( VP, D0 );
+		__m128i const HP = _mm_or_si128( VN, _mm_andnot_si128( _mm_or_si128( VP, D0 ), _mm_set1_epi64x( -1 ) ) );
+		X = _mm_slli_epi64( HP, 1 );
+		VN = _mm_and_si128( X, D0 );
+		VP = _mm_or_si128( _mm_slli_epi64( HN, 1 ), _mm_andnot_si128( _mm_or_si128( X, D0 ), _mm_set1_epi64x( -1 ) ) );
+		errors = _mm_add_epi64( errors, _mm_and_si128( _mm_srl_epi64( HP, shift ), one ) );
+		errors = _mm_sub_epi64( errors, _mm_and_si128( _mm_srl_epi64( HN, shift ), one ) );
+
+		__m128i const pos = _mm_set1_epi64x( j );
+		__m128i better = _mm_and_si128( _mm_cmpgt_epi32( best, errors ), _mm_cmpgt_epi32( lengths, pos ) );
+		better = _mm_shuffle_epi32( better, _MM_SHUFFLE( 2, 2, 0, 0 ) );
+		best = _mm_or_si128( _mm_and_si128( better, errors ), _mm_andnot_si128( better, best ) );
+		best_pos = _mm_or_si128( _mm_and_si128( better, pos ), _mm_andnot_si128( better, best_pos ) );
+	}
+
+	__uint64 best_lanes[ 2 ], best_pos_lanes[ 2 ];
+	_mm_storeu_si128( (__m128i *) best_lanes, best );
+	_mm_storeu_si128( (__m128i *) best_pos_lanes, best_pos );
+	for ( unsigned l = 0; l < num_texts; l++ ){
+		best_errors[ l ] = best_lanes[ l ];
+		best_end[ l ] = int( best_pos_lanes[ l ] );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// up to 4 texts.
+__attribute__(( target( "avx2" ) ))
+inline
+void
+find_best_in_texts_avx2( MultiTextMyersPattern const & pattern,
+												 CharString const * const * texts,
+												 unsigned const num_texts,
+												 unsigned * best_errors,
+												 int * best_end ){
+	char const * t[ 4 ] = { 0, 0, 0, 0 };
+	unsigned text_length[ 4 ] = { 0, 0, 0, 0 };
+	unsigned max_length( 0 );
+	for ( unsigned l = 0; l < num_texts; l++ ){
+		t[ l ] = begin( *texts[ l ], Standard() );
+		text_length[ l ] = length( *texts[ l ] );
+		if ( text_length[ l ] > max_length ) max_length = text_length[ l ];
+	}
+
+	__m128i const shift = _mm_cvtsi32_si128( pattern.length - 1 );
+	__m256i const one = _mm256_set1_epi64x( 1 );
+	__m256i const all_ones = _mm256_set1_epi64x( -1 );
+	__m256i const lengths = _mm256_set_epi64x( text_length[ 3 ], text_length[ 2 ], text_length[ 1 ], text_length[ 0 ] );
+	__m256i VP = all_ones, VN = _mm256_setzero_si256();
+	__m256i errors = _mm256_set1_epi64x( pattern.length );
+	__m256i best = errors, best_pos = all_ones;
+	for ( unsigned j = 0; j < max_length; j++ ){
+		__m256i X = _mm256_set_epi64x( get_multi_text_myers_peq( pattern, t[ 3 ], text_length[ 3 ], j ),
+																	 get_multi_text_myers_peq( pattern, t[ 2 ], text_length[ 2 ], j ),
+																	 get_multi_text_myers_peq( pattern, t[ 1 ], text_length[ 1 ], j ),
+																	 get_multi_text_myers_peq( pattern, t[ 0 ], text_length[ 0 ], j ) );
+		X = _mm256_or_si256( X, VN );
+		__m256i const D0 = _mm256_or_si256( _mm256_xor_si256( _mm256_add_epi64( VP, _mm256_and_si256( X, VP ) ), VP ), X );
+		__m256i const HN = _mm256_and_si256( VP, D0 );
+		__m256i const HP = _mm256_or_si256( VN, _mm256_andnot_si256( _mm256_or_si256( VP, D0 ), all_ones ) );
+		X = _mm256_slli_epi64( HP, 1 );
+		VN = _mm256_and_si256( X, D0 );
+		VP = _mm256_or_si256( _mm256_slli_epi64( HN, 1 ), _mm256_andnot_si256( _mm256_or_si256( X, D0 ), all_ones ) );
+		errors = _mm256_add_epi64( errors, _mm256_and_si256( _mm256_srl_epi64( HP, shift ), one ) );
+		errors = _mm256_sub_epi64( errors, _mm256_and_si256( _mm256_srl_epi64( HN, shift ), one ) );
+
+		__m256i const pos = _mm256_set1_epi64x( j );
+		__m256i const better = _mm256_and_si256( _mm256_cmpgt_epi64( best, errors ), _mm256_cmpgt_epi64( lengths, pos ) );
+		best = _mm256_blendv_epi8( best, errors, better );
+		best_pos = _mm256_blendv_epi8( best_pos, pos, better );
+	}
+
+	__uint64 best_lanes[ 4 ], best_pos_lanes[ 4 ];
+	_mm256_storeu_si256( (__m256i *) best_lanes, best );
+	_mm256_storeu_si256( (__m256i *) best_pos_lanes, best_pos );
+	for ( unsigned l = 0; l < num_texts; l++ ){
+		best_errors[ l ] = best_lanes[ l ];
+		best_end[ l ] = int( best_pos_lanes[ l ] );
+	}
+}
+
+#endif // MAPSEEKER_MYERS_SIMD_X86
+
+////////////////////////////////////////////////////////////////
+// best_errors[ n ] is the fewest edits of any match of the pattern ending in texts[ n ], and best_end[ n ] is
+// where the first such match ends [-1 if best_errors is the pattern length, i.e., nothing better than no match].
+inline
+void
+find_best_in_texts( MultiTextMyersPattern const & pattern,
+										CharString const * const * texts,
+										unsigned const num_texts,
+										MultiTextMyersKernel const kernel,
+										unsigned * best_errors,
+										int * best_end ){
+	unsigned const lanes = get_multi_text_myers_lanes( kernel );
+	for ( unsigned n = 0; n < num_texts; n += lanes ){
+		unsigned const num_in_group = std::min( lanes, num_texts - n );
+#ifdef MAPSEEKER_MYERS_SIMD_X86
+		if ( kernel == AVX2_MYERS_KERNEL && num_in_group > 2 ) {
+			find_best_in_texts_avx2( pattern, texts + n, num_in_group, best_errors + n, best_end + n );
+			continue;
+		}
+		if ( kernel != SCALAR_MYERS_KERNEL && num_in_group > 1 ) {
+			find_best_in_texts_sse2( pattern, texts + n, num_in_group, best_errors + n, best_end + n );
+			continue;
+		}
+#endif
+		for ( unsigned l = 0; l < num_in_group; l++ ) find_best_in_texts_scalar( pattern, *texts[ n + l ], best_errors[ n + l ], best_end[ n + l ] );
+	}
+}
+
+#endif  // #ifndef MAPSEEKER_MYERS_SIMD_H
@@ -0,0 +1,295 @@
+#ifndef MAPSEEKER_READ2_CACHE_H
+#define MAPSEEKER_READ2_CACHE_H
+
+#include <vector>
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/parallel.h>
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// Where read 2 lands only depends on the possible sequence IDs from read 1, the expt ID, and the
+// sequence of read 2 -- and the same combination comes up over and over in a MAP-seq run, even when
+// read 1 differs by sequencing errors. So find_read2_placements() results get cached, keyed by all three.
+//
+// The cache is shared by all threads and holds at most a fixed number of entries, dropping the least
+// recently used. It is split into shards by hash, each behind its own spin lock, so threads rarely wait.
+// Entries keep their full key, so a hash collision can never return the wrong placements.
+////////////////////////////////////////////////////////////////
+
+unsigned const read2_cache_num_shards( 64 );
+unsigned const no_read2_cache_entry( ~0u );
+
+struct Read2CacheEntry {
+	__uint64 hash;
+	int expt_idx;
+	std::vector< unsigned > possible_sids;
+	CharString seq2;
+	std::vector< unsigned > mpos_vector, sid_vector;
+	int mscr;
+	unsigned bucket_next; // next entry in the same hash bucket.
+	unsigned lru_prev, lru_next; // towards more/less recently used.
+};
+
+struct Read2CacheShard {
+	Read2CacheShard();
+
+	int volatile lock;
+	std::vector< Read2CacheEntry > entries; // grows up to capacity; after that, the least recently used entry gets reused.
+	std::vector< unsigned > buckets;
+	unsigned capacity, lru_first, lru_last;
+	unsigned long hits, misses;
+	char padding[ 64 ]; // keep the locks of different shards on different cache lines.
+};
+
+struct Read2Cache {
+	Read2Cache();
+
+	bool enabled;
+	std::vector< Read2CacheShard > shards;
+};
+
+void
+setup_read2_cache( Read2Cache & cache, unsigned const num_entries );
+
+__uint64
+hash_read2_key( std::vector< unsigned > const & possible_sids, int const expt_idx, CharString const & seq2 );
+
+bool
+find_cached_read2_placements( Read2Cache & cache,
+															std::vector< unsigned > const & possible_sids,
+															int const expt_idx,
+															CharString const & seq2,
+															std::vector< unsigned > & mpos_vector,
+															std::vector< unsigned > & sid_vector,
+															int & mscr );
+
+void
+cache_read2_placements( Read2Cache & cache,
+												std::vector< unsigned > const & possible_sids,
+												int const expt_idx,
+												CharString const & seq2,
+												std::vector< unsigned > const & mpos_vector,
+												std::vector< unsigned > const & sid_vector,
+												int const mscr );
+
+unsigned long
+get_read2_cache_hits( Read2Cache const & cache );
+
+unsigned long
+get_read2_cache_misses( Read2Cache const & cache );
+
+////////////////////////////////////////////////////////////////
+inline
+Read2CacheShard::Read2CacheShard():
+	lock( 0 ),
+	capacity( 0 ),
+	lru_first( no_read2_cache_entry ),
+	lru_last( no_read2_cache_entry ),
+	hits( 0 ),
+	misses( 0 )
+{}
+
+////////////////////////////////////////////////////////////////
+inline
+Read2Cache::Read2Cache():
+	enabled( false )
+{}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+setup_read2_cache( Read2Cache & cache, unsigned const num_entries ){
+	cache.enabled = ( num_entries > 0 );
+	cache.shards.clear();
+	if ( !cache.enabled ) return;
+
+	cache.shards.resize( read2_cache_num_shards );
+	unsigned const capacity = ( num_entries + read2_cache_num_shards - 1 ) / read2_cache_num_shards;
+	unsigned num_buckets( 1 );
+	while ( num_buckets < 2 * capacity ) num_buckets *= 2;
+	for ( unsigned n = 0; n < cache.shards.size(); n++ ){
+		cache.shards[ n ].capacity = capacity;
+		cache.shards[ n ].entries.reserve( capacity );
+		cache.shards[ n ].buckets.assign( num_buckets, no_read2_cache_entry );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+__uint64
+hash_read2_key( std::vector< unsigned > const & possible_sids, int const expt_idx, CharString const & seq2 ){
+	__uint64 hash = __uint64( expt_idx + 1 ) * 0x9E3779B97F4A7C15ULL;
+	for ( unsigned n = 0; n < possible_sids.size(); n++ ) hash = ( hash ^ possible_sids[ n ] ) * 0x100000001B3ULL;
+	for ( unsigned i = 0; i < length( seq2 ); i++ ) hash = ( hash ^ (unsigned char) seq2[ i ] ) * 0x100000001B3ULL;
+	return hash ^ ( hash >> 29 );
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+lock_read2_cache_shard( Read2CacheShard & shard ){
+	while ( atomicCas( shard.lock, 0, 1 ) != 0 ) {}
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+unlock_read2_cache_shard( Read2CacheShard & shard ){
+	atomicCas( shard.lock, 1, 0 );
+}
+
+////////////////////////////////////////////////////////////////
+inline
+Read2CacheShard &
+get_read2_cache_shard( Read2Cache & cache, __uint64 const hash ){
+	return cache.shards[ ( hash >> 32 ) % cache.shards.size() ];
+}
+
+////////////////////////////////////////////////////////////////
+// entry with this key in a locked shard, or no_read2_cache_entry.
+inline
+unsigned
+find_read2_cache_entry( Read2CacheShard const & shard,
+												__uint64 const hash,
+												std::vector< unsigned > const & possible_sids,
+												int const expt_idx,
+												CharString const & seq2 ){
+	unsigned e = shard.buckets[ hash & ( shard.buckets.size() - 1 ) ];
+	while ( e != no_read2_cache_entry ){
+		Read2CacheEntry const & entry = shard.entries[ e ];
+		if ( entry.hash == hash && entry.expt_idx == expt_idx && entry.possible_sids == possible_sids && entry.seq2 == seq2 ) return e;
+		e = entry.bucket_next;
+	}
+	return no_read2_cache_entry;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+unlink_read2_cache_lru( Read2CacheShard & shard, unsigned const e ){
+	Read2CacheEntry & entry = shard.entries[ e ];
+	if ( entry.lru_prev != no_read2_cache_entry ) shard.entries[ entry.lru_prev ].lru_next = entry.lru_next;
+	else shard.lru_first = entry.lru_next;
+	if ( entry.lru_next != no_read2_cache_entry ) shard.entries[ entry.lru_next ].lru_prev = entry.lru_prev;
+	else shard.lru_last = entry.lru_prev;
+}
+
+////////////////////////////////////////////////////////////////
+// most recently used goes first.
+inline
+void
+link_read2_cache_lru( Read2CacheShard & shard, unsigned const e ){
+	Read2CacheEntry & entry = shard.entries[ e ];
+	entry.lru_prev = no_read2_cache_entry;
+	entry.lru_next = shard.lru_first;
+	if ( shard.lru_first != no_read2_cache_entry ) shard.entries[ shard.lru_first ].lru_prev = e;
+	shard.lru_first = e;
+	if ( shard.lru_last == no_read2_cache_entry ) shard.lru_last = e;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+unlink_read2_cache_bucket( Read2CacheShard & shard, unsigned const e ){
+	unsigned * link = &shard.buckets[ shard.entries[ e ].hash & ( shard.buckets.size() - 1 ) ];
+	while ( *link != e ) link = &shard.entries[ *link ].bucket_next;
+	*link = shard.entries[ e ].bucket_next;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+bool
+find_cached_read2_placements( Read2Cache & cache,
+															std::vector< unsigned > const & possible_sids,
+															int const expt_idx,
+															CharString const & seq2,
+															std::vector< unsigned > & mpos_vector,
+															std::vector< unsigned > & sid_vector,
+															int & mscr ){
+	__uint64 const hash = hash_read2_key( possible_sids, expt_idx, seq2 );
+	Read2CacheShard & shard = get_read2_cache_shard( cache, hash );
+
+	lock_read2_cache_shard( shard );
+	unsigned const e = find_read2_cache_entry( shard, hash, possible_sids, expt_idx, seq2 );
+	if ( e == no_read2_cache_entry ) {
+		shard.misses++;
+		unlock_read2_cache_shard( shard );
+		return false;
+	}
+	Read2CacheEntry const & entry = shard.entries[ e ];
+	mpos_vector = entry.mpos_vector;
+	sid_vector = entry.sid_vector;
+	mscr = entry.mscr;
+	unlink_read2_cache_lru( shard, e );
+	link_read2_cache_lru( shard, e );
+	shard.hits++;
+	unlock_read2_cache_shard( shard );
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+void
+cache_read2_placements( Read2Cache & cache,
+												std::vector< unsigned > const & possible_sids,
+												int const expt_idx,
+												CharString const & seq2,
+												std::vector< unsigned > const & mpos_vector,
+												std::vector< unsigned > const & sid_vector,
+												int const mscr ){
+	__uint64 const hash = hash_read2_key( possible_sids, expt_idx, seq2 );
+	Read2CacheShard & shard = get_read2_cache_shard( cache, hash );
+
+	lock_read2_cache_shard( shard );
+	if ( find_read2_cache_entry( shard, hash, possible_sids, expt_idx, seq2 ) != no_read2_cache_entry ) { // another thread got here first.
+		unlock_read2_cache_shard( shard );
+		return;
+	}
+
+	unsigned e;
+	if ( shard.entries.size() < shard.capacity ) {
+		e = shard.entries.size();
+		shard.entries.push_back( Read2CacheEntry() );
+	} else {
+		e = shard.lru_last;
+		unlink_read2_cache_lru( shard, e );
+		unlink_read2_cache_bucket( shard, e );
+	}
+
+	Read2CacheEntry & entry = shard.entries[ e ];
+	entry.hash = hash;
+	entry.expt_idx = expt_idx;
+	entry.possible_sids = possible_sids;
+	entry.seq2 = seq2;
+	entry.mpos_vector = mpos_vector;
+	entry.sid_vector = sid_vector;
+	entry.mscr = mscr;
+
+	unsigned & bucket = shard.buckets[ hash & ( shard.buckets.size() - 1 ) ];
+	entry.bucket_next = bucket;
+	bucket = e;
+	link_read2_cache_lru( shard, e );
+	unlock_read2_cache_shard( shard );
+}
+
+////////////////////////////////////////////////////////////////
+inline
+unsigned long
+get_read2_cache_hits( Read2Cache const & cache ){
+	unsigned long hits( 0 );
+	for ( unsigned n = 0; n < cache.shards.size(); n++ ) hits += cache.shards[ n ].hits;
+	return hits;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+unsigned long
+get_read2_cache_misses( Read2Cache const & cache ){
+	unsigned long misses( 0 );
+	for ( unsigned n = 0; n < cache.shards.size(); n++ ) misses += cache.shards[ n ].misses;
+	return misses;
+}
+
+#endif  // #ifndef MAPSEEKER_READ2_CACHE_H
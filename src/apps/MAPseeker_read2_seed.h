@@ -0,0 +1,165 @@
+#ifndef MAPSEEKER_READ2_SEED_H
+#define MAPSEEKER_READ2_SEED_H
+
+#include <iostream>
+#include <vector>
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+using namespace seqan;
+
+////////////////////////////////////////////////////////////////
+// Most read 2s match their reference exactly, and then all that the Myers search in search_read2_in_reference()
+// keeps is where read 2 occurs exactly. Those occurrences can be found by looking up the first nts of read 2
+// [its seed] in an index of the references, and checking the rest of read 2 against each hit.
+//
+// The index holds every position in every reference where a seed-length stretch of ACGT starts, keyed by the
+// stretch packed 2 bits per nucleotide. Stretches within the RNA sequence are the same for every expt ID, so
+// they are entered once; stretches that run into the expt ID and adapter get one entry per expt ID. Entries
+// are grouped by hash bucket in one array, and within a bucket are in order of sequence ID, then position.
+////////////////////////////////////////////////////////////////
+
+unsigned const max_read2_seed_length( 32 );
+
+// about 400 MB.
+size_t const read2_seed_index_max_entries( 1 << 24 );
+
+struct Read2SeedEntry {
+	__uint64 seed;
+	unsigned sid;
+	int pos;
+	int expt_idx; // -1 if the seed lies within the RNA sequence, so it holds for any expt ID.
+};
+
+struct Read2SeedIndex {
+	Read2SeedIndex();
+
+	bool enabled;
+	unsigned seed_length;
+	unsigned bucket_bits;
+	std::vector< unsigned > bucket_begin; // entries of bucket b are [ bucket_begin[ b ], bucket_begin[ b+1 ] ).
+	std::vector< Read2SeedEntry > entries;
+};
+
+template < typename TSeq >
+bool
+pack_read2_seed( __uint64 & seed, TSeq const & seq, unsigned const pos, unsigned const seed_length );
+
+unsigned
+get_read2_seed_bucket( Read2SeedIndex const & index, __uint64 const seed );
+
+void
+setup_read2_seed_index( Read2SeedIndex & index,
+												std::vector< CharString > const & RNA_sequences,
+												std::vector< CharString > const & references,
+												std::vector< int > const & mpos_max,
+												unsigned const num_expt_ids,
+												unsigned const seed_length );
+
+////////////////////////////////////////////////////////////////
+inline
+Read2SeedIndex::Read2SeedIndex():
+	enabled( false ),
+	seed_length( 0 ),
+	bucket_bits( 0 )
+{}
+
+////////////////////////////////////////////////////////////////
+// false if the seed would run off the end of seq, or has anything but ACGT.
+template < typename TSeq >
+inline
+bool
+pack_read2_seed( __uint64 & seed, TSeq const & seq, unsigned const pos, unsigned const seed_length ){
+	if ( pos + seed_length > length( seq ) ) return false;
+	seed = 0;
+	for ( unsigned i = pos; i < pos + seed_length; i++ ){
+		__uint64 code;
+		switch ( seq[ i ] ){
+		case 'A': code = 0; break;
+		case 'C': code = 1; break;
+		case 'G': code = 2; break;
+		case 'T': code = 3; break;
+		default: return false;
+		}
+		seed = ( seed << 2 ) | code;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+inline
+unsigned
+get_read2_seed_bucket( Read2SeedIndex const & index, __uint64 const seed ){
+	if ( index.bucket_bits == 0 ) return 0;
+	return unsigned( ( seed * 0x9E3779B97F4A7C15ULL ) >> ( 64 - index.bucket_bits ) );
+}
+
+////////////////////////////////////////////////////////////////
+// references are the RNA sequences with expt ID and adapter [sid * num_expt_ids + expt_idx], as in ReferenceArena;
+// placements past mpos_max + 1 can never count [see place_read2_by_seed()], so are left out.
+inline
+void
+setup_read2_seed_index( Read2SeedIndex & index,
+												std::vector< CharString > const & RNA_sequences,
+												std::vector< CharString > const & references,
+												std::vector< int > const & mpos_max,
+												unsigned const num_expt_ids,
+												unsigned const seed_length ){
+	index.enabled = false;
+	index.bucket_begin.clear();
+	index.entries.clear();
+	if ( seed_length == 0 || num_expt_ids == 0 ) return;
+	index.seed_length = std::min( seed_length, max_read2_seed_length );
+
+	std::vector< Read2SeedEntry > entries;
+	Read2SeedEntry entry;
+	for ( unsigned s = 0; s < RNA_sequences.size(); s++ ){
+		int const RNA_length = length( RNA_sequences[ s ] );
+		int last_pos( -1 );
+		for ( unsigned e = 0; e < num_expt_ids; e++ ) last_pos = std::max( last_pos, mpos_max[ size_t( s ) * num_expt_ids + e ] + 1 );
+		int const first_reference_pos = std::max( 0, RNA_length - int( index.seed_length ) + 1 );
+
+		// check the limit before adding, so that one long sequence cannot blow past it.
+		size_t num_new_entries = std::max( 0, std::min( last_pos, RNA_length - int( index.seed_length ) ) + 1 );
+		for ( unsigned e = 0; e < num_expt_ids; e++ ){
+			num_new_entries += std::max( 0, std::min( last_pos, mpos_max[ size_t( s ) * num_expt_ids + e ] + 1 ) - first_reference_pos + 1 );
+		}
+		if ( entries.size() + num_new_entries > read2_seed_index_max_entries ) {
+			std::cout << "Library too big to index for read 2 seeds; will search for every read 2." << std::endl;
+			return;
+		}
+
+		entry.sid = s;
+		entry.expt_idx = -1;
+		for ( int pos = 0; pos <= last_pos && pos + int( index.seed_length ) <= RNA_length; pos++ ){
+			if ( !pack_read2_seed( entry.seed, RNA_sequences[ s ], pos, index.seed_length ) ) continue;
+			entry.pos = pos;
+			entries.push_back( entry );
+		}
+		for ( int pos = first_reference_pos; pos <= last_pos; pos++ ){
+			for ( unsigned e = 0; e < num_expt_ids; e++ ){
+				size_t const n = size_t( s ) * num_expt_ids + e;
+				if ( pos > mpos_max[ n ] + 1 ) continue;
+				if ( !pack_read2_seed( entry.seed, references[ n ], pos, index.seed_length ) ) continue;
+				entry.pos = pos;
+				entry.expt_idx = e;
+				entries.push_back( entry );
+			}
+		}
+	}
+
+	index.bucket_bits = 0;
+	while ( ( size_t( 1 ) << index.bucket_bits ) < entries.size() ) index.bucket_bits++;
+	unsigned const num_buckets = 1 << index.bucket_bits;
+
+	// counting sort by bucket, which keeps the order within each bucket.
+	index.bucket_begin.assign( num_buckets + 1, 0 );
+	for ( unsigned i = 0; i < entries.size(); i++ ) index.bucket_begin[ get_read2_seed_bucket( index, entries[ i ].seed ) + 1 ]++;
+	for ( unsigned b = 0; b < num_buckets; b++ ) index.bucket_begin[ b + 1 ] += index.bucket_begin[ b ];
+	std::vector< unsigned > next( index.bucket_begin.begin(), index.bucket_begin.end() - 1 );
+	index.entries.resize( entries.size() );
+	for ( unsigned i = 0; i < entries.size(); i++ ) index.entries[ next[ get_read2_seed_bucket( index, entries[ i ].seed ) ]++ ] = entries[ i ];
+	index.enabled = true;
+}
+
+#endif  // #ifndef MAPSEEKER_READ2_SEED_H
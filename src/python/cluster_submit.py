@@ -6,7 +6,7 @@ from os.path import basename,dirname,expanduser,exists
 import string
 
 def Help():
-    print argv[0]+' <text file with MAPSEEKER command> <# jobs>  [# hours]'
+    print argv[0]+' <text file with MAPSEEKER command> <# jobs>  [# hours] [-save_logs] [-byte_range]'
     print " note that MAPseeker command must have flag  --outpath <outpath> to specify path."
     print " only condor stuff has been tested carefully at this point."
     exit()
@@ -34,6 +34,13 @@ if argv.count( '-save_logs' )>0:
     pos = argv.index( '-save_logs' )
     del( argv[pos] )
 
+# split up fastq files by byte range instead of by read -- each job only reads through its own part of the files.
+byte_range = False
+if argv.count( '-byte_range' )>0:
+    byte_range = True
+    pos = argv.index( '-byte_range' )
+    del( argv[pos] )
+
 nhours = 16
 if len( argv ) > 4:
     nhours = int( argv[4] )
@@ -100,8 +107,11 @@ for line in lines:
 
     if command_line.find( "MAPseeker" ) > -1 :
         command_line += " --outpath "+dir
-        command_line += " -j %d" % n_jobs
-        command_line += " --start_at_read $(Process)"
+        if byte_range:
+            command_line += " --byte_range $(Process)/%d" % n_jobs
+        else:
+            command_line += " -j %d" % n_jobs
+            command_line += " --start_at_read $(Process)"
 
     cols = string.split( command_line )
 
@@ -174,8 +184,8 @@ for line in lines:
     EXE = HOMEDIR + '/src/map_seeker/src/cmake/apps/MAPseeker'
     assert( exists( EXE ) )
 
-    # reducer script for DAGMAN runs
-    REDUCER = dirname( EXE )+'/../../python/cat_stats.py'
+    # reducer for DAGMAN runs -- sums up stats files from all the jobs.
+    REDUCER = dirname( EXE )+'/MAPseeker_merge'
 
     arguments = string.join( cols[ 1: ] )
 
@@ -186,7 +196,7 @@ for line in lines:
         fid_condor.write( 'error  = %s\n' % errfile_general )
     fid_condor.write('Queue %d\n' % n_jobs )
 
-    reducer_command = '%s %s ' % (REDUCER, outdir)
+    reducer_command = '%s -O %s %s/*/ ' % (REDUCER, outdir, outdir)
     #reducer_command = '%s %s --delete' % (REDUCER, outdir)
     fid_condor_dagman.write( 'JOB %s %s\n' % (job_name, condor_file ) )
     fid_condor_dagman.write( 'SCRIPT POST %s %s\n\n' % (job_name, reducer_command) )
@@ -37,6 +37,10 @@
 // TODO(holtgrew): This could use some cleanup.
 
 #include <ctime>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
 
 //SEQAN_NO_GENERATED_FORWARDS: no forwards are generated for this file
 
@@ -646,6 +650,163 @@ if (printTiming)
         a += x;
         return x;
     }
+
+    // ----------------------------------------------------------------------
+    // Per-stage timers
+    // ----------------------------------------------------------------------
+    // Call counts and wall clock latencies for the stages of a hot loop,
+    // e.g. the filters of a read mapping cascade. Unlike the SEQAN_PRO*
+    // values above these are not global: every thread keeps its own
+    // ProfileStageTimes, so nothing is locked while timing, and the threads'
+    // times are summed up with mergeProfileStageTimes() at the end.
+    // Timers are switched off unless enabled is set, in which case a
+    // ScopedProfileTimer costs a single branch.
+    //
+    // Latencies go into log-scale buckets with 4 buckets per factor of 2
+    // (starting at 1ns), so percentiles are good to about 20%.
+
+    struct ProfileStageTimes
+    {
+        enum { BUCKETS_PER_OCTAVE = 4, NUM_BUCKETS = 4 * 40 };
+
+        bool enabled;
+        std::vector<ProfileInt_> calls;
+        std::vector<ProfileInt_> hits;        // calls that found something, as counted by the caller
+        std::vector<_proFloat> totalTime;
+        std::vector<_proFloat> maxTime;
+        std::vector<ProfileInt_> histogram;   // [stage * NUM_BUCKETS + bucket]
+
+        ProfileStageTimes() : enabled(false) {}
+    };
+
+    inline void
+    resizeProfileStageTimes(ProfileStageTimes & times, unsigned numStages, bool enabled)
+    {
+        times.enabled = enabled;
+        times.calls.assign(numStages, 0);
+        times.hits.assign(numStages, 0);
+        times.totalTime.assign(numStages, 0);
+        times.maxTime.assign(numStages, 0);
+        times.histogram.assign((size_t)numStages * ProfileStageTimes::NUM_BUCKETS, 0);
+    }
+
+    inline unsigned
+    _profileLatencyBucket(_proFloat seconds)
+    {
+        if (!(seconds >= 1e-9)) return 0;
+        int exponent;
+        _proFloat mantissa = std::frexp(seconds * 1e9, &exponent);  // in [0.5, 1)
+        int bucket = (exponent - 1) * ProfileStageTimes::BUCKETS_PER_OCTAVE + (int)((mantissa - 0.5) * 2 * ProfileStageTimes::BUCKETS_PER_OCTAVE);
+        if (bucket >= ProfileStageTimes::NUM_BUCKETS) bucket = ProfileStageTimes::NUM_BUCKETS - 1;
+        return bucket;
+    }
+
+    // upper end of a bucket, in seconds.
+    inline _proFloat
+    _profileLatencyBucketEnd(unsigned bucket)
+    {
+        return std::ldexp(1.0 + (_proFloat)(bucket % ProfileStageTimes::BUCKETS_PER_OCTAVE + 1) / ProfileStageTimes::BUCKETS_PER_OCTAVE,
+                          bucket / ProfileStageTimes::BUCKETS_PER_OCTAVE) * 1e-9;
+    }
+
+    inline void
+    addProfileStageTime(ProfileStageTimes & times, unsigned stage, _proFloat seconds)
+    {
+        ++times.calls[stage];
+        times.totalTime[stage] += seconds;
+        if (seconds > times.maxTime[stage]) times.maxTime[stage] = seconds;
+        ++times.histogram[(size_t)stage * ProfileStageTimes::NUM_BUCKETS + _profileLatencyBucket(seconds)];
+    }
+
+    inline void
+    addProfileStageHit(ProfileStageTimes & times, unsigned stage)
+    {
+        if (times.enabled) ++times.hits[stage];
+    }
+
+    inline void
+    mergeProfileStageTimes(ProfileStageTimes & times, ProfileStageTimes const & other)
+    {
+        if (times.calls.size() < other.calls.size())
+            resizeProfileStageTimes(times, other.calls.size(), other.enabled);
+        times.enabled = times.enabled || other.enabled;
+        for (unsigned s = 0; s < other.calls.size(); ++s)
+        {
+            times.calls[s] += other.calls[s];
+            times.hits[s] += other.hits[s];
+            times.totalTime[s] += other.totalTime[s];
+            if (other.maxTime[s] > times.maxTime[s]) times.maxTime[s] = other.maxTime[s];
+        }
+        for (size_t b = 0; b < other.histogram.size(); ++b)
+            times.histogram[b] += other.histogram[b];
+    }
+
+    // latency below which the given fraction of a stage's calls fall [0 if never called].
+    inline _proFloat
+    profileStagePercentile(ProfileStageTimes const & times, unsigned stage, double fraction)
+    {
+        ProfileInt_ const rank = (ProfileInt_)std::ceil(fraction * times.calls[stage]);
+        ProfileInt_ seen = 0;
+        for (unsigned b = 0; b < ProfileStageTimes::NUM_BUCKETS; ++b)
+        {
+            seen += times.histogram[(size_t)stage * ProfileStageTimes::NUM_BUCKETS + b];
+            if (seen > 0 && seen >= rank)
+            {
+                _proFloat end = _profileLatencyBucketEnd(b);
+                return (end < times.maxTime[stage]) ? end : times.maxTime[stage];
+            }
+        }
+        return 0;
+    }
+
+    // Adds the time until it goes out of scope to a stage.
+    struct ScopedProfileTimer
+    {
+        ProfileStageTimes * times;
+        unsigned stage;
+        _proFloat start;
+
+        ScopedProfileTimer(ProfileStageTimes & times_, unsigned stage_) :
+            times(times_.enabled ? &times_ : 0), stage(stage_), start(times ? sysTime() : 0) {}
+
+        ~ScopedProfileTimer()
+        {
+            stop();
+        }
+
+        // for stages that end before the scope does.
+        void stop()
+        {
+            if (times) addProfileStageTime(*times, stage, sysTime() - start);
+            times = 0;
+        }
+
+    private:
+        ScopedProfileTimer(ScopedProfileTimer const &);
+        ScopedProfileTimer & operator=(ScopedProfileTimer const &);
+    };
+
+    // Writes the stage times as a JSON array with one object per stage, e.g. for scripts that
+    // compare runs. stageNames has one name per stage; indent goes in front of every line but the first.
+    inline void
+    writeProfileStageTimesJson(std::ostream & out, ProfileStageTimes const & times, std::string const * stageNames, std::string const & indent)
+    {
+        out << "[" << std::endl;
+        for (unsigned s = 0; s < times.calls.size(); ++s)
+        {
+            out << indent << "  { \"name\": \"" << stageNames[s] << "\""
+                << ", \"calls\": " << times.calls[s]
+                << ", \"hits\": " << times.hits[s]
+                << ", \"total_seconds\": " << times.totalTime[s]
+                << ", \"mean_seconds\": " << (times.calls[s] ? times.totalTime[s] / times.calls[s] : 0)
+                << ", \"p50_seconds\": " << profileStagePercentile(times, s, 0.5)
+                << ", \"p90_seconds\": " << profileStagePercentile(times, s, 0.9)
+                << ", \"p99_seconds\": " << profileStagePercentile(times, s, 0.99)
+                << ", \"max_seconds\": " << times.maxTime[s]
+                << " }" << ((s + 1 < times.calls.size()) ? "," : "") << std::endl;
+        }
+        out << indent << "]";
+    }
 }
 
 #endif  // #ifndef SEQAN_CORE_INCLUDE_SEQAN_BASIC_PROFILING_H_
@@ -57,6 +57,7 @@
 #include <seqan/find/find_simple.h>
 #include <seqan/find/find_horspool.h>
 #include <seqan/find/find_shiftand.h>
+#include <seqan/find/find_indel_shiftand.h>
 #include <seqan/find/find_shiftor.h>
 #include <seqan/find/find_bndm.h>
 #include <seqan/find/find_bom.h>
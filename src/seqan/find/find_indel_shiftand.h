@@ -0,0 +1,339 @@
+// ==========================================================================
+//                 SeqAn - The Library for Sequence Analysis
+// ==========================================================================
+// Copyright (c) 2006-2013, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+
+#ifndef SEQAN_HEADER_FIND_INDEL_SHIFTAND_H
+#define SEQAN_HEADER_FIND_INDEL_SHIFTAND_H
+
+namespace SEQAN_NAMESPACE_MAIN
+{
+
+//////////////////////////////////////////////////////////////////////////////
+// IndelShiftAnd
+//////////////////////////////////////////////////////////////////////////////
+
+/*!
+ * @class IndelShiftAndPattern
+ * @extends Pattern
+ * @headerfile <seqan/find.h>
+ * @brief Approximate string matching with indels, using bit parallelism.
+ *
+ * @signature template <typename TNeedle>
+ *            class Pattern<TNeedle, IndelShiftAnd>;
+ *
+ * @tparam TNeedle The needle type. Types: String
+ *
+ * @section Remarks
+ *
+ * Finds the end positions of all infix matches of the needle that need at most <tt>-scoreLimit</tt>
+ * insertions and deletions, and scores each one by minus that number. A mismatch counts as an
+ * insertion plus a deletion.
+ *
+ * This gives exactly the hits and scores of @link DPSearchPattern @endlink with a @link SimpleScore @endlink
+ * of 0 for a match, -1 for a gap, and -2 [or less] for a mismatch: there, a mismatch is never better
+ * than a deletion followed by an insertion, so the best alignment score is minus the indel distance.
+ * Instead of filling a DP column per haystack character, the Shift-And algorithm is run with one bit
+ * vector per number of indels [Wu-Manber, without the substitution term].
+ *
+ * The types of the needle and the haystack have to match.
+ */
+
+/**
+.Spec.IndelShiftAnd:
+..summary:Approximate string matching with indels, using bit parallelism. Gives the same hits and scores as DPSearch with SimpleScore(0, -2, -1).
+..general:Class.Pattern
+..cat:Searching
+..signature:Pattern<TNeedle, IndelShiftAnd>
+..param.TNeedle:The needle type.
+...type:Class.String
+..remarks.text:A mismatch counts as an insertion plus a deletion. The types of the needle and the haystack have to match.
+..include:seqan/find.h
+*/
+
+///.Class.Pattern.param.TSpec.type:Spec.IndelShiftAnd
+
+struct IndelShiftAnd_;
+typedef Tag<IndelShiftAnd_> IndelShiftAnd;
+
+//////////////////////////////////////////////////////////////////////////////
+
+template <typename TNeedle>
+class Pattern<TNeedle, IndelShiftAnd> {
+//____________________________________________________________________________
+public:
+	typedef __uint64 TWord;
+	enum { MACHINE_WORD_SIZE = sizeof(TWord) * 8 };
+
+	String<TWord> bitMasks;			// Look up table for each character in the alphabet (called B in "Navarro")
+	String<TWord> prefSufMatch;		// for each number of indels d, the prefixes of needle that match a suffix of haystack with at most d indels
+	String<TWord> oldPrefSufMatch;	// prefSufMatch before the current character [needles longer than a word]
+	TWord needleLength;
+	TWord blockCount;				// #words required to store needle
+	int data_limit;					// minimal score of a hit, i.e. minus the maximal number of indels
+	int data_score;					// score of the last hit
+
+//____________________________________________________________________________
+
+	Pattern():
+		needleLength(0),
+		blockCount(1),
+		data_limit(0),
+		data_score(0)
+	{}
+
+	template <typename TNeedle2>
+	Pattern(TNeedle2 const & ndl, int _limit = 0):
+		data_limit(_limit),
+		data_score(0)
+	{
+		setHost(*this, ndl);
+	}
+
+//____________________________________________________________________________
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Functions
+//////////////////////////////////////////////////////////////////////////////
+
+template <typename TNeedle, typename TNeedle2>
+inline void
+setHost(Pattern<TNeedle, IndelShiftAnd> & me, TNeedle2 const & needle)
+{
+SEQAN_CHECKPOINT
+	typedef typename Pattern<TNeedle, IndelShiftAnd>::TWord TWord;
+	typedef typename Value<TNeedle>::Type TValue;
+
+	me.needleLength = length(needle);
+	if (me.needleLength < 1)
+		me.blockCount = 1;
+	else
+		me.blockCount = (me.needleLength - 1) / me.MACHINE_WORD_SIZE + 1;
+
+	clear(me.bitMasks);
+	resize(me.bitMasks, me.blockCount * ValueSize<TValue>::VALUE, 0, Exact());
+
+	for (TWord j = 0; j < me.needleLength; ++j)
+		me.bitMasks[
+			me.blockCount * ordValue(convert<TValue>(getValue(needle, j)))
+			+ j / me.MACHINE_WORD_SIZE
+		] |= (TWord)1 << (j % me.MACHINE_WORD_SIZE);
+}
+
+template <typename TNeedle, typename TNeedle2>
+inline void
+setHost(Pattern<TNeedle, IndelShiftAnd> & me, TNeedle2 & needle)
+{
+	setHost(me, reinterpret_cast<TNeedle2 const &>(needle));
+}
+
+//____________________________________________________________________________
+
+template <typename TNeedle>
+inline int
+scoreLimit(Pattern<TNeedle, IndelShiftAnd> const & me)
+{
+SEQAN_CHECKPOINT
+	return me.data_limit;
+}
+
+template <typename TNeedle>
+inline void
+setScoreLimit(Pattern<TNeedle, IndelShiftAnd> & me, int _limit)
+{
+SEQAN_CHECKPOINT
+	me.data_limit = _limit;
+}
+
+// returns the score of the last hit position found (note:position = end of occurrence in haystack)
+template <typename TNeedle>
+inline int
+getScore(Pattern<TNeedle, IndelShiftAnd> const & me)
+{
+SEQAN_CHECKPOINT
+	return me.data_score;
+}
+
+//____________________________________________________________________________
+
+// before the first character of the haystack, the first d characters of the needle can be deleted.
+template <typename TNeedle>
+inline void
+_patternInit (Pattern<TNeedle, IndelShiftAnd> & me)
+{
+SEQAN_CHECKPOINT
+	typedef typename Pattern<TNeedle, IndelShiftAnd>::TWord TWord;
+
+	unsigned const maxIndels = -me.data_limit;
+	clear(me.prefSufMatch);
+	resize(me.prefSufMatch, (maxIndels + 1) * me.blockCount, 0, Exact());
+	for (unsigned d = 0; d <= maxIndels; ++d)
+		for (unsigned j = 0; j < d && j < me.needleLength; ++j)
+			me.prefSufMatch[d * me.blockCount + j / me.MACHINE_WORD_SIZE] |= (TWord)1 << (j % me.MACHINE_WORD_SIZE);
+}
+
+//____________________________________________________________________________
+
+// for each d, going up:
+//   new D[d] = (((D[d] << 1) | 1) & B[c])   match
+//            | D[d-1]                       insertion [c is extra]
+//            | ((new D[d-1] << 1) | 1)      deletion [needle character is missing]
+template <typename TFinder, typename TNeedle>
+inline bool
+_findIndelShiftAndSmallNeedle(TFinder & finder, Pattern<TNeedle, IndelShiftAnd> & me)
+{
+SEQAN_CHECKPOINT
+	typedef typename Value<TNeedle>::Type TValue;
+	typedef typename Pattern<TNeedle, IndelShiftAnd>::TWord TWord;
+
+	TWord const compare = (TWord)1 << (me.needleLength - 1);
+	unsigned const maxIndels = -me.data_limit;
+	TWord * prefSufMatch = begin(me.prefSufMatch, Standard());
+	TWord const * bitMasks = begin(me.bitMasks, Standard());
+
+	while (!atEnd(finder))
+	{
+		TWord const mask = bitMasks[ordValue(convert<TValue>(getValue(finder)))];
+		TWord previousOld = prefSufMatch[0];
+		TWord previousNew = ((previousOld << 1) | (TWord)1) & mask;
+		prefSufMatch[0] = previousNew;
+		int score = ((previousNew & compare) != 0) ? 0 : 1;
+		for (unsigned d = 1; d <= maxIndels; ++d)
+		{
+			TWord const old = prefSufMatch[d];
+			TWord const current = (((old << 1) | (TWord)1) & mask) | previousOld | (previousNew << 1) | (TWord)1;
+			prefSufMatch[d] = current;
+			if (score > 0 && (current & compare) != 0)
+				score = -(int)d;
+			previousOld = old;
+			previousNew = current;
+		}
+		if (score <= 0)
+		{
+			me.data_score = score;
+			_setFinderEnd(finder);
+			return true;
+		}
+		goNext(finder);
+	}
+	return false;
+}
+
+template <typename TFinder, typename TNeedle>
+inline bool
+_findIndelShiftAndLargeNeedle(TFinder & finder, Pattern<TNeedle, IndelShiftAnd> & me)
+{
+SEQAN_CHECKPOINT
+	typedef typename Value<TNeedle>::Type TValue;
+	typedef typename Pattern<TNeedle, IndelShiftAnd>::TWord TWord;
+
+	TWord const compare = (TWord)1 << ((me.needleLength - 1) % me.MACHINE_WORD_SIZE);
+	unsigned const maxIndels = -me.data_limit;
+	unsigned const blockCount = me.blockCount;
+	resize(me.oldPrefSufMatch, length(me.prefSufMatch), Exact());
+	TWord * prefSufMatch = begin(me.prefSufMatch, Standard());
+	TWord * oldPrefSufMatch = begin(me.oldPrefSufMatch, Standard());
+
+	while (!atEnd(finder))
+	{
+		TWord const * mask = begin(me.bitMasks, Standard()) + blockCount * ordValue(convert<TValue>(getValue(finder)));
+		arrayCopyForward(prefSufMatch, prefSufMatch + (maxIndels + 1) * blockCount, oldPrefSufMatch);
+		int score = 1;
+		for (unsigned d = 0; d <= maxIndels; ++d)
+		{
+			TWord * current = prefSufMatch + d * blockCount;
+			TWord const * old = oldPrefSufMatch + d * blockCount;
+			TWord const * previous = (d > 0) ? current - blockCount : current; // D[d-1], new and old.
+			TWord const * previousOld = (d > 0) ? old - blockCount : old;
+			TWord carryOld = 1, carryNew = 1;
+			for (unsigned block = 0; block < blockCount; ++block)
+			{
+				TWord value = ((old[block] << 1) | carryOld) & mask[block];
+				carryOld = old[block] >> (me.MACHINE_WORD_SIZE - 1);
+				if (d > 0)
+				{
+					value |= previousOld[block] | (previous[block] << 1) | carryNew;
+					carryNew = previous[block] >> (me.MACHINE_WORD_SIZE - 1);
+				}
+				current[block] = value;
+			}
+			if (score > 0 && (current[blockCount - 1] & compare) != 0)
+				score = -(int)d;
+		}
+		if (score <= 0)
+		{
+			me.data_score = score;
+			_setFinderEnd(finder);
+			return true;
+		}
+		goNext(finder);
+	}
+	return false;
+}
+
+//____________________________________________________________________________
+
+template <typename TFinder, typename TNeedle>
+inline bool
+find(TFinder & finder, Pattern<TNeedle, IndelShiftAnd> & me)
+{
+SEQAN_CHECKPOINT
+	if (me.data_limit > 0 || me.needleLength < 1)
+		return false;
+
+	if (empty(finder))
+	{
+		_patternInit(me);
+		_finderSetNonEmpty(finder);
+	}
+	else
+		goNext(finder);
+
+	// Fast algorithm for needles < machine word?
+	if (me.blockCount == 1)
+		return _findIndelShiftAndSmallNeedle(finder, me);
+	else
+		return _findIndelShiftAndLargeNeedle(finder, me);
+}
+
+template <typename TFinder, typename TNeedle>
+inline bool
+find(TFinder & finder, Pattern<TNeedle, IndelShiftAnd> & me, int const limit_)
+{
+SEQAN_CHECKPOINT
+	setScoreLimit(me, limit_);
+	return find(finder, me);
+}
+
+}// namespace SEQAN_NAMESPACE_MAIN
+
+#endif //#ifndef SEQAN_HEADER_FIND_INDEL_SHIFTAND_H
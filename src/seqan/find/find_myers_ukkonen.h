@@ -1447,6 +1447,140 @@ SEQAN_CHECKPOINT
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+// Same as _findMyersLargePatterns, for a number of blocks known at compile time
+// (needles of up to BLOCK_COUNT * MACHINE_WORD_SIZE characters). The bit vectors
+// are kept in local arrays while scanning, so they are not reloaded through the
+// state's strings for every character, and the carries are computed without
+// branches. The state is written back before returning, so findBegin() and
+// resuming the search work exactly as for the generic version.
+//////////////////////////////////////////////////////////////////////////////
+
+template <unsigned BLOCK_COUNT, typename TFinder, typename TNeedle, typename TSpec, typename THasState, typename THasState2, typename TFindBeginPatternSpec, typename TSize>
+inline bool _findMyersLargePatternsFixed (TFinder & finder, 
+										  Pattern<TNeedle, Myers<TSpec, THasState, TFindBeginPatternSpec> > const & pattern,
+										  PatternState_<TNeedle, Myers<TSpec, THasState2, TFindBeginPatternSpec> > & state,
+										  TSize haystack_length) 
+{
+SEQAN_CHECKPOINT
+	typedef MyersLargePattern_<TNeedle, TSpec> TLargePattern;
+	typedef MyersLargeState_<TNeedle, TSpec> TLargeState;
+    typedef typename TLargeState::TWord TWord;
+
+	TLargePattern &largePattern = *pattern.largePattern;
+	TLargeState &largeState = *state.largeState;
+	SEQAN_ASSERT_EQ(largePattern.blockCount, BLOCK_COUNT);
+
+	TWord VP[BLOCK_COUNT], VN[BLOCK_COUNT];
+	for (unsigned block = 0; block < BLOCK_COUNT; ++block)
+	{
+		VP[block] = largeState.VP[block];
+		VN[block] = largeState.VN[block];
+	}
+	TWord const * bitMasks = begin(pattern.bitMasks, Standard());
+	TWord const finalScoreMask = largePattern.finalScoreMask;
+	unsigned lastBlock = largeState.lastBlock;
+	TWord scoreMask = largeState.scoreMask;
+	unsigned errors = state.errors;
+	unsigned const maxErrors = state.maxErrors;
+	bool found = false;
+
+	while (position(finder) < haystack_length) 
+	{
+		TWord carryD0 = 0, carryHN = 0;
+		TWord carryHP = (int)MyersUkkonenHP0_<TSpec>::VALUE;
+
+		// if the active cell is the last of it's block, one additional block has to be calculated
+		unsigned limit = lastBlock + (unsigned)(scoreMask >> (pattern.MACHINE_WORD_SIZE - 1));
+		if (limit == BLOCK_COUNT)
+			limit--;
+
+		TWord const * masks = bitMasks + BLOCK_COUNT * ordValue((typename Value< TNeedle >::Type) *finder);
+
+		for (unsigned currentBlock = 0; currentBlock <= limit; currentBlock++) 
+		{
+			TWord const vp = VP[currentBlock], vn = VN[currentBlock];
+			TWord X = masks[currentBlock] | vn;
+
+			TWord const sum = vp + (X & vp);
+			TWord const temp = sum + carryD0;
+			carryD0 = (TWord)(sum < vp) | (TWord)(temp < sum);
+			
+			TWord const D0 = (temp ^ vp) | X;
+			TWord const HN = vp & D0;
+			TWord const HP = vn | ~(vp | D0);
+			
+			X = (HP << 1) | carryHP;
+			carryHP = HP >> (pattern.MACHINE_WORD_SIZE - 1);
+			VN[currentBlock] = X & D0;
+			VP[currentBlock] = (HN << 1) | carryHN | ~(X | D0);
+			carryHN = HN >> (pattern.MACHINE_WORD_SIZE - 1);
+
+			// if the current block is the one containing the last active cell
+			// the new number of errors is computed
+			if (currentBlock == lastBlock) {
+				if ((HP & scoreMask) != (TWord)0)
+					errors++;
+				else if ((HN & scoreMask) != (TWord)0)
+					errors--;
+			}
+		}
+
+		// updating the last active cell
+		while (errors > maxErrors) {
+			if ((VP[lastBlock] & scoreMask) != (TWord)0)
+				errors--;
+			else if ((VN[lastBlock] & scoreMask) != (TWord)0)
+				errors++;
+
+			scoreMask >>= 1;
+			if (scoreMask == (TWord)0) 
+			{
+				lastBlock--;
+				if (IsSameType<TSpec, FindPrefix>::VALUE && lastBlock == (unsigned)-1)
+					break;
+				scoreMask = (TWord)1 << (pattern.MACHINE_WORD_SIZE - 1);
+			}
+		}
+
+		if ((scoreMask == finalScoreMask) && (lastBlock == BLOCK_COUNT - 1))
+		{
+			_setFinderEnd(finder);
+			if (IsSameType<TSpec, FindPrefix>::VALUE)
+			{
+				_setFinderLength(finder, endPosition(finder));
+			}
+			found = true;
+			break;
+		}
+		else {
+			scoreMask <<= 1;
+			if (!scoreMask) {
+				scoreMask = 1;
+				lastBlock++;
+			}
+			
+			if ((VP[lastBlock] & scoreMask) != (TWord)0)
+				errors++;
+			else if ((VN[lastBlock] & scoreMask) != (TWord)0)
+				errors--;
+		}
+
+		goNext(finder);
+	}
+
+	for (unsigned block = 0; block < BLOCK_COUNT; ++block)
+	{
+		largeState.VP[block] = VP[block];
+		largeState.VN[block] = VN[block];
+	}
+	largeState.lastBlock = lastBlock;
+	largeState.scoreMask = scoreMask;
+	state.errors = errors;
+	return found;
+}
+
+
 template <typename TFinder, typename TNeedle, typename TSpec, typename THasState, typename THasState2, typename TFindBeginPatternSpec, typename TSize>
 inline bool 
 _findMyersSmallPatterns(
@@ -1733,8 +1867,16 @@ SEQAN_CHECKPOINT
 	// distinguish between the version for needles not longer than one machineword and the version for longer needles
 	if (pattern.largePattern == NULL) 
 		return _findMyersSmallPatterns(finder, pattern, state, haystack_length);
-	else
-		return _findMyersLargePatterns(finder, pattern, state, haystack_length);
+
+	// needles of a few machine words get a kernel with the block count known at compile time
+	switch (pattern.largePattern->blockCount)
+	{
+		case 2: return _findMyersLargePatternsFixed<2>(finder, pattern, state, haystack_length);
+		case 3: return _findMyersLargePatternsFixed<3>(finder, pattern, state, haystack_length);
+		case 4: return _findMyersLargePatternsFixed<4>(finder, pattern, state, haystack_length);
+		case 5: return _findMyersLargePatternsFixed<5>(finder, pattern, state, haystack_length);
+		default: return _findMyersLargePatterns(finder, pattern, state, haystack_length);
+	}
 }
 
 